@@ -3,13 +3,149 @@ var i = 0;
 var data = [];
 var ip = '128.97.179.236';
 
-function xhrRequest(url, type, callback) {
+// Samples are collected here and posted to the collector as raw AccelData
+// records once there are FLUSH_SAMPLES of them or FLUSH_MS has passed.
+// Bodies the collector did not take wait in offline, oldest first, up to
+// OFFLINE_MAX of them, and go out before anything new. A failed post is
+// tried again after RETRY_MS, doubling up to RETRY_MAX_MS, so they are
+// resent even once streaming stops.
+var FLUSH_SAMPLES = 1500; // a minute at 25 Hz
+var FLUSH_MS = 30000;
+var OFFLINE_MAX = 60;
+var RETRY_MS = 5000;
+var RETRY_MAX_MS = 300000;
+var RECORD_BYTES = 15;
+
+var pending = [];
+var pending_samples = 0;
+var flush_timer = null;
+var offline = [];
+var posting = false; // offline[0] is being posted
+var retry_timer = null;
+var retry_ms = RETRY_MS;
+var dropped = 0; // on the watch, as last reported
+var lost = 0; // samples of bodies pushed out of offline
+
+// posts one body, calling done(true) once the collector has taken it
+function postBody(body, done) {
   var xhr = new XMLHttpRequest();
   xhr.onload = function () {
-    callback(this.responseText);
+    done(this.status >= 200 && this.status < 300);
   };
-  xhr.open(type, url);
-  xhr.send();
+  xhr.onerror = function () {
+    done(false);
+  };
+  xhr.open('POST', 'http://'+ip+'/ripple/upload');
+  xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+  xhr.setRequestHeader('X-Ripple-Dropped', String(dropped));
+  xhr.setRequestHeader('X-Ripple-Lost', String(lost));
+  xhr.send(body.buffer);
+}
+
+// sends the oldest waiting body, and the next once that is through
+function drain() {
+  if (retry_timer !== null) {
+    clearTimeout(retry_timer);
+    retry_timer = null;
+  }
+  if (posting || offline.length === 0) {
+    return;
+  }
+  posting = true;
+  postBody(offline[0], function(ok) {
+    posting = false;
+    if (!ok) {
+      console.log('Collector unreachable, ' + offline.length + ' bodies waiting');
+      retry_timer = setTimeout(drain, retry_ms);
+      retry_ms = Math.min(retry_ms * 2, RETRY_MAX_MS);
+      return;
+    }
+    retry_ms = RETRY_MS;
+    offline.shift();
+    drain();
+  });
+}
+
+function flush() {
+  var body, pos = 0;
+  if (flush_timer !== null) {
+    clearTimeout(flush_timer);
+    flush_timer = null;
+  }
+  if (pending_samples > 0) {
+    body = new Uint8Array(pending_samples * RECORD_BYTES);
+    pending.forEach(function(bytes) {
+      body.set(bytes, pos);
+      pos += bytes.length;
+    });
+    pending = [];
+    pending_samples = 0;
+    if (offline.length === OFFLINE_MAX) {
+      // the oldest body not being posted, which drain() will shift
+      lost += offline.splice(posting ? 1 : 0, 1)[0].length / RECORD_BYTES;
+    }
+    offline.push(body);
+  }
+  drain();
+}
+
+function collect(raw) {
+  pending.push(raw);
+  pending_samples += raw.length / RECORD_BYTES;
+  if (pending_samples >= FLUSH_SAMPLES) {
+    flush();
+  } else if (flush_timer === null) {
+    flush_timer = setTimeout(flush, FLUSH_MS);
+  }
+}
+
+// Reads the KEY_DATA_PACKED value built by pack_queue() in ripple.c into
+// [{x, y, z, did_vibrate, timestamp}]. Arithmetic instead of bit operators
+// keeps 64 bit timestamps exact.
+function decodeBatch(bytes) {
+  var pos = 0;
+  function varint() {
+    var v = 0, scale = 1, b;
+    do {
+      if (pos >= bytes.length) {
+        throw new Error('packed batch ends early');
+      }
+      b = bytes[pos++];
+      v += (b & 0x7f) * scale;
+      scale *= 128;
+    } while (b & 0x80);
+    return v;
+  }
+  function unzigzag(v) {
+    return v % 2 ? -(v + 1) / 2 : v / 2;
+  }
+  var n = varint();
+  var t = varint();
+  var x = 0, y = 0, z = 0, step, k;
+  var samples = [];
+  for (k = 0; k < n; k++) {
+    x += unzigzag(varint());
+    y += unzigzag(varint());
+    z += unzigzag(varint());
+    step = varint();
+    t += Math.floor(step / 2);
+    samples.push({x: x, y: y, z: z, did_vibrate: step % 2, timestamp: t});
+  }
+  return samples;
+}
+
+// the raw little-endian AccelData records the collector takes, 15 bytes each
+function rawBatch(samples) {
+  var bytes = [];
+  samples.forEach(function(s) {
+    var t = s.timestamp, k;
+    bytes.push(s.x & 0xff, (s.x >> 8) & 0xff, s.y & 0xff, (s.y >> 8) & 0xff, s.z & 0xff, (s.z >> 8) & 0xff, s.did_vibrate);
+    for (k = 0; k < 8; k++) {
+      bytes.push(t % 256);
+      t = Math.floor(t / 256);
+    }
+  });
+  return bytes;
 }
 
 /*
@@ -42,6 +178,14 @@ Pebble.addEventListener('appmessage',
 			    console.log('AppMessage received!');
 			    //console.log(JSON.stringify(e,null,2));
 			    //parseAccelData(e.payload);
-			    xhrRequest('http://'+ip+'/ripple/?data='+JSON.stringify(e.payload['KEY_DATA']), 'GET', function(response) {
-			    });
+			    var raw = e.payload['KEY_DATA'];
+			    if (e.payload['KEY_DATA_PACKED']) {
+				raw = rawBatch(decodeBatch(e.payload['KEY_DATA_PACKED']));
+			    }
+			    if (e.payload['KEY_DROPPED'] !== undefined) {
+				dropped = e.payload['KEY_DROPPED'];
+			    }
+			    if (raw) {
+				collect(raw);
+			    }
 			});
@@ -9,14 +9,127 @@
 #define NUM_SAMPLES 25
 //#define ACCEL_STEP_MS 50
 #define KEY_DATA 0
+#define KEY_DATA_PACKED 1
+#define KEY_DROPPED 2 // samples dropped since launch, sent with every message
+
+// bytes a packed sample can take: three 3 byte axis changes and a 10 byte
+// time step, and the most a message header can take
+#define PACKED_SAMPLE_MAX 19
+#define PACKED_HEADER_MAX 15
+#define PACKED_MAX 1024 // bytes per message, at most
+
+#define QUEUE_SAMPLES 250 // 10 s at 25 Hz
+#define RETRY_MS 500
+
+// Samples waiting to go to the phone. The first s_in_flight of them are in
+// the message being sent and only leave once it is acknowledged; samples
+// that find the queue full are dropped and counted.
+static AccelData s_queue[QUEUE_SAMPLES];
+static int s_queue_head;
+static int s_queue_len;
+static int s_in_flight;
+static uint32_t s_dropped;
+static uint32_t s_retries;
 
 static Window *s_main_window;
 static TextLayer *s_output_layer;
 static TextLayer *s_output_layer2;
+static char s_counters[64];
+
+// small changes of either sign to small unsigned numbers: 0, -1, 1, -2 ...
+static uint32_t zigzag(int32_t v) {
+  return v < 0 ? ((uint32_t)-v << 1) - 1 : (uint32_t)v << 1;
+}
+
+// little-endian base-128, 7 bits a byte, high bit set on all but the last
+static int put_varint(uint8_t *buf, uint64_t v) {
+  int n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = v;
+  return n;
+}
+
+// Packs as many queued samples as fit in max bytes, as varint sample
+// count, varint timestamp of the first sample, then for each sample the
+// zigzag varint change of x, y and z from the previous one (from 0 for the
+// first) and varint (ms since the previous sample << 1 | did_vibrate).
+// x, y and z are coded as in ripple_real's codec.c; decodeBatch() in
+// pebble-js-app.js reads it back. Leaves the samples packed in count.
+static int pack_queue(uint8_t *buf, int max, int *count) {
+  uint8_t header[PACKED_HEADER_MAX], sample[PACKED_SAMPLE_MAX];
+  AccelData *a = &s_queue[s_queue_head];
+  int16_t px = 0, py = 0, pz = 0;
+  uint64_t first = a->timestamp, pt = first;
+  int i, k, h, n = 0;
+
+  // samples go after room for the header, which needs the count
+  for (i = 0; i < s_queue_len; i++) {
+    a = &s_queue[(s_queue_head+i)%QUEUE_SAMPLES];
+    k = put_varint(sample, zigzag(a->x - px));
+    k += put_varint(&sample[k], zigzag(a->y - py));
+    k += put_varint(&sample[k], zigzag(a->z - pz));
+    k += put_varint(&sample[k], (a->timestamp - pt) << 1 | a->did_vibrate);
+    if (PACKED_HEADER_MAX + n + k > max) {
+      break;
+    }
+    memcpy(&buf[PACKED_HEADER_MAX+n], sample, k);
+    n += k;
+    px = a->x;
+    py = a->y;
+    pz = a->z;
+    pt = a->timestamp;
+  }
+  h = put_varint(header, i);
+  h += put_varint(&header[h], first);
+  memmove(&buf[h], &buf[PACKED_HEADER_MAX], n);
+  memcpy(buf, header, h);
+  *count = i;
+  return h+n;
+}
+
+// shows how full the queue is and what it has dropped
+static void show_counters() {
+  snprintf(s_counters, sizeof(s_counters), "Queued: %d\nDropped: %d", s_queue_len, (int)s_dropped);
+  text_layer_set_text(s_output_layer2, s_counters);
+}
+
+// sends the head of the queue unless a message is already on its way. Under
+// a slow link the queue grows, and each message takes as much of it as fits.
+static void send_queued() {
+  static uint8_t packed[PACKED_MAX];
+  DictionaryIterator *iter;
+  int max, len;
+
+  show_counters();
+  if (s_in_flight || s_queue_len == 0) {
+    return;
+  }
+  max = app_message_outbox_size_maximum() - dict_calc_buffer_size(2, 0, sizeof(uint32_t));
+  if (max > PACKED_MAX) {
+    max = PACKED_MAX;
+  }
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    return; // the next batch tries again
+  }
+  len = pack_queue(packed, max, &s_in_flight);
+  dict_write_data(iter, KEY_DATA_PACKED, packed, len);
+  dict_write_uint32(iter, KEY_DROPPED, s_dropped);
+  if (app_message_outbox_send() != APP_MSG_OK) {
+    s_in_flight = 0;
+  }
+}
+
+static void retry_send(void *data) {
+  send_queued();
+}
 
 static void data_handler(AccelData *data, uint32_t num_samples) {
   // Long lived buffer
   static char s_buffer[128];
+  uint32_t i;
 
   // Compose string of all data
   snprintf(s_buffer, sizeof(s_buffer), 
@@ -24,14 +137,16 @@ static void data_handler(AccelData *data, uint32_t num_samples) {
 	   data[0].x, data[0].y, data[0].z
 	   );
 
-  uint8_t data_buffer[dict_calc_buffer_size(1, sizeof(AccelData) * NUM_SAMPLES)];
-  DictionaryIterator iter;
-  DictionaryIterator *iter_p = &iter;
-  dict_write_begin(iter_p, data_buffer, sizeof(data_buffer));
-  app_message_outbox_begin(&iter_p);
-  dict_write_data(iter_p, KEY_DATA, (uint8_t *)data, sizeof(AccelData) * NUM_SAMPLES);
-  app_message_outbox_send();
-  dict_write_end(iter_p);
+  for (i = 0; i < num_samples; i++) {
+    if (s_queue_len == QUEUE_SAMPLES) {
+      s_dropped += num_samples-i;
+      APP_LOG(APP_LOG_LEVEL_WARNING, "Queue full, dropped %d samples", (int)(num_samples-i));
+      break;
+    }
+    s_queue[(s_queue_head+s_queue_len)%QUEUE_SAMPLES] = data[i];
+    s_queue_len++;
+  }
+  send_queued();
 
   //Show the data
   text_layer_set_text(s_output_layer, s_buffer);
@@ -92,10 +207,21 @@ static void inbox_dropped_callback(AppMessageResult reason, void *context) {
 
 static void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context) {
   APP_LOG(APP_LOG_LEVEL_ERROR, "Outbox send failed!");
+  if (s_in_flight) { // the samples stay queued for the retry
+    s_in_flight = 0;
+    s_retries++;
+    app_timer_register(RETRY_MS, retry_send, NULL);
+  }
 }
 
 static void outbox_sent_callback(DictionaryIterator *iterator, void *context) {
   APP_LOG(APP_LOG_LEVEL_INFO, "Outbox send success!");
+  if (s_in_flight) {
+    s_queue_head = (s_queue_head+s_in_flight)%QUEUE_SAMPLES;
+    s_queue_len -= s_in_flight;
+    s_in_flight = 0;
+    send_queued();
+  }
 }
 
 static void up_click_handler(ClickRecognizerRef recognizer, void *context) {
@@ -147,7 +273,7 @@ static void init() {
 }
 
 static void deinit() {
-  APP_LOG(APP_LOG_LEVEL_INFO, "App closed!");
+  APP_LOG(APP_LOG_LEVEL_INFO, "App closed! %d samples dropped, %d retries", (int)s_dropped, (int)s_retries);
 
   // Destroy main Window
   window_destroy(s_main_window);
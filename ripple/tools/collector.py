@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""
+collector.py
+Stand-in for the ripple collector, for testing the phone upload path on a
+laptop. Takes the POST /ripple/upload bodies sent by pebble-js-app.js (raw
+little-endian AccelData records, 15 bytes each) and appends them to a CSV
+of timestamp, x, y, z, did_vibrate. Point ip in pebble-js-app.js at this
+machine and run
+
+    python3 collector.py [--port 80] [--out samples.csv] [--trace trace.bin] [--fail 0.3]
+
+--trace also appends the bodies as they came, the trace format
+ripple_real/host/replay reads. --fail refuses that share of uploads, to
+exercise the phone's offline queue.
+"""
+
+import argparse
+import http.server
+import random
+import struct
+import time
+
+RECORD = struct.Struct('<hhhBQ')
+
+
+class Collector(http.server.BaseHTTPRequestHandler):
+    def do_POST(self):
+        if self.path != '/ripple/upload':
+            self.send_error(404)
+            return
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        if len(body) % RECORD.size:
+            self.send_error(400, 'body is not whole records')
+            return
+        if random.random() < self.server.fail:
+            self.send_error(503, 'refused for testing')
+            return
+        with open(self.server.out, 'a') as f:
+            for x, y, z, vib, t in RECORD.iter_unpack(body):
+                f.write('%d,%d,%d,%d,%d\n' % (t, x, y, z, vib))
+        if self.server.trace:
+            with open(self.server.trace, 'ab') as f:
+                f.write(body)
+        n = len(body) // RECORD.size
+        self.server.samples += n
+        self.server.requests += 1
+        self.server.bytes += len(body)
+        print('%s %d samples in %d bytes, dropped %s lost %s, total %d samples %d requests %d bytes' % (
+            time.strftime('%H:%M:%S'), n, len(body),
+            self.headers.get('X-Ripple-Dropped', '?'), self.headers.get('X-Ripple-Lost', '?'),
+            self.server.samples, self.server.requests, self.server.bytes))
+        self.send_response(204)
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('--port', type=int, default=80)
+    ap.add_argument('--out', default='samples.csv')
+    ap.add_argument('--trace')
+    ap.add_argument('--fail', type=float, default=0.0)
+    args = ap.parse_args()
+
+    server = http.server.HTTPServer(('', args.port), Collector)
+    server.out = args.out
+    server.trace = args.trace
+    server.fail = args.fail
+    server.samples = server.requests = server.bytes = 0
+    print('collecting on port %d into %s' % (args.port, args.out))
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
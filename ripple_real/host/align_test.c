@@ -0,0 +1,132 @@
+/*
+ * align_test.c
+ * Checks that align() and align_span() return the delay the original
+ * exhaustive align() did, lag for lag, on random, gravity-offset, flat and
+ * all-zero motions, with captures at every start of the ring so that the
+ * wrap is covered.
+ *
+ *   make -C host check
+ */
+
+#include <pebble.h>
+#include "align.h"
+#include "rng.h"
+
+#define ROUNDS 200000
+
+#define max(a,b) (((a)>(b))?(a):(b))
+#define min(a,b) ((a>b)?(b):(a))
+#define abs(a) (((a)>0)?(a):(-(a)))
+
+// the align() this repo started from, with its lags limited to
+// ALIGN_MAX_LAG as align_span() does
+static int baseline_align(DataVec *ges1, int size1, DataVec *ges2, int size2) {
+  int i, j, lo, hi;
+  int sumx = 0, sumy = 0, sumz = 0;
+  int maxx = 0, maxy = 0, maxz = 0, minx = 0, miny = 0, minz = 0, delx = 0, dely = 0, delz = 0, del = 0, maxd, dy, dz;
+  lo = max(-size2+1, -ALIGN_MAX_LAG);
+  hi = min(size1+size2-1, ALIGN_MAX_LAG);
+  for (i = lo; i <= hi; i++) {
+    sumx = 0;
+    sumy = 0;
+    sumz = 0;
+    for (j = max(0,i); j < min(size1,i+size2); j++) {
+      sumx += ges1[j].x*ges2[j-i].x;
+      sumy += ges1[j].y*ges2[j-i].y;
+      sumz += ges1[j].z*ges2[j-i].z;
+    }
+    if (i == lo) {
+      maxx = minx = sumx;
+      maxy = miny = sumy;
+      maxz = minz = sumz;
+      delx = dely = delz = i;
+    } else {
+      if (sumx > maxx) {
+        maxx = sumx;
+        delx = i;
+      }
+      minx = min(minx, sumx);
+      if (sumy > maxy) {
+        maxy = sumy;
+        dely = i;
+      }
+      miny = min(miny, sumy);
+      if (sumz > maxz) {
+        maxz = sumz;
+        delz = i;
+      }
+      minz = min(minz, sumz);
+    }
+  }
+  del = delx;
+  maxd = abs(maxx-minx);
+  dy = abs(maxy-miny);
+  dz = abs(maxz-minz);
+  if (dy > maxd) {
+    del = dely;
+    maxd = dy;
+  }
+  if (dz > maxd) {
+    del = delz;
+  }
+  return del;
+}
+
+// one of the kinds of motion, in mG
+static void motion(DataVec *v, int size, int kind) {
+  int j, x = 0, y = 0, z = 0;
+  for (j = 0; j < size; j++) {
+    switch (kind) {
+    case 0: // noise over the whole range
+      v[j] = (DataVec) { rnd(8001)-4000, rnd(8001)-4000, rnd(8001)-4000 };
+      break;
+    case 1: // a wandering wrist with gravity on z
+      x += rnd(401)-200;
+      y += rnd(401)-200;
+      z += rnd(401)-200;
+      v[j] = (DataVec) { max(-4000, min(4000, x)), max(-4000, min(4000, y)), max(-4000, min(4000, z-1000)) };
+      break;
+    case 2: // flat, with a few levels so that lags tie
+      v[j] = (DataVec) { (rnd(3)-1)*500, (rnd(3)-1)*500, -1000 };
+      break;
+    default:
+      v[j] = (DataVec) { 0, 0, 0 };
+      break;
+    }
+  }
+}
+
+int main() {
+  DataVec ring[MAX_BUFF_SIZE], flat[MAX_BUFF_SIZE], ref[MAX_REF_SIZE];
+  Span span;
+  int round, size1, size2, start, j, want, got, failed = 0;
+
+  for (round = 0; round < ROUNDS; round++) {
+    size1 = 1 + rnd(MAX_BUFF_SIZE);
+    size2 = 1 + rnd(MAX_REF_SIZE);
+    start = rnd(MAX_BUFF_SIZE);
+    motion(flat, size1, rnd(4));
+    motion(ref, size2, rnd(4));
+    want = baseline_align(flat, size1, ref, size2);
+
+    got = align(flat, size1, ref, size2);
+    if (got != want) {
+      fprintf(stderr, "round %d: align() gave %d for %d, sizes %d and %d\n", round, got, want, size1, size2);
+      failed++;
+    }
+
+    motion(ring, MAX_BUFF_SIZE, 0); // what is outside the span must not count
+    for (j = 0; j < size1; j++) {
+      ring[(start+j)%MAX_BUFF_SIZE] = flat[j];
+    }
+    span = (Span) { .ring = ring, .cap = MAX_BUFF_SIZE, .start = start, .size = size1 };
+    got = align_span(&span, ref, size2);
+    if (got != want) {
+      fprintf(stderr, "round %d: align_span() gave %d for %d, sizes %d and %d from %d\n",
+              round, got, want, size1, size2, start);
+      failed++;
+    }
+  }
+  printf("align_test: %d rounds, %d failed\n", ROUNDS, failed);
+  return failed != 0;
+}
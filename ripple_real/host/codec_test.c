@@ -0,0 +1,135 @@
+/*
+ * codec_test.c
+ * Round-trips sample streams through codec_encode() and codec_decode():
+ * empty input, full-scale swings between -32768 and 32767 that need the
+ * widest varints, and random motion. Every truncation of an encoding, and
+ * varints that never end, must be refused rather than read past.
+ *
+ *   make -C host check
+ */
+
+#include <pebble.h>
+#include "codec.h"
+#include "rng.h"
+
+#define ROUNDS 20000
+#define MAX_SAMPLES 200
+
+static int failed;
+
+// encodes v, checks that it decodes to itself and, with cuts, that no
+// shorter buffer will do for either side. Returns the encoded length.
+static int round_trip(const char *what, const DataVec *v, int n, bool cuts) {
+  static uint8_t buf[CODEC_MAX_BYTES(MAX_SAMPLES)];
+  DataVec out[MAX_SAMPLES];
+  uint8_t *cut;
+  int len, got, k;
+
+  len = codec_encode(v, n, buf, sizeof(buf));
+  if (n > 0 && len == 0) {
+    fprintf(stderr, "%s: %d samples did not fit in %d bytes\n", what, n, (int)sizeof(buf));
+    failed++;
+    return 0;
+  }
+  if (len > CODEC_MAX_BYTES(n)) {
+    fprintf(stderr, "%s: %d samples took %d bytes, over CODEC_MAX_BYTES\n", what, n, len);
+    failed++;
+  }
+  if (n > 0 && codec_encode(v, n, buf, len-1) != 0) {
+    fprintf(stderr, "%s: encoding passed max %d\n", what, len-1);
+    failed++;
+  }
+
+  got = codec_decode(buf, len, out, n);
+  if (got != len || memcmp(v, out, n*sizeof(DataVec))) {
+    fprintf(stderr, "%s: %d samples in %d bytes decoded wrong, read %d\n", what, n, len, got);
+    failed++;
+  }
+
+  // each cut-down copy sits at the end of its own block, so reading past it
+  // shows up under a memory checker as well as in the result
+  for (k = 0; cuts && k < len; k++) {
+    cut = malloc(k ? k : 1);
+    memcpy(cut, buf, k);
+    if (codec_decode(cut, k, out, n) != 0) {
+      fprintf(stderr, "%s: decoded %d samples from %d of %d bytes\n", what, n, k, len);
+      failed++;
+    }
+    free(cut);
+  }
+  return len;
+}
+
+static void test_empty() {
+  uint8_t buf[1] = { 0xaa };
+  DataVec v = { 1, 2, 3 };
+  if (codec_encode(&v, 0, buf, 0) != 0 || codec_decode(buf, 0, &v, 0) != 0
+      || buf[0] != 0xaa || v.x != 1 || v.y != 2 || v.z != 3) {
+    fprintf(stderr, "empty: wrote or read something\n");
+    failed++;
+  }
+}
+
+// every change from -32768 to 32767 and back is the widest zigzag there is
+static void test_extremes() {
+  DataVec v[MAX_SAMPLES];
+  int i, len;
+  for (i = 0; i < MAX_SAMPLES; i++) {
+    v[i].x = (i & 1) ? 32767 : -32768;
+    v[i].y = (i & 1) ? -32768 : 32767;
+    v[i].z = (i & 1) ? -32767 : 32767;
+  }
+  len = round_trip("extremes", v, MAX_SAMPLES, true);
+  if (len != CODEC_MAX_BYTES(MAX_SAMPLES)) {
+    fprintf(stderr, "extremes: %d bytes, not the worst case %d\n", len, CODEC_MAX_BYTES(MAX_SAMPLES));
+    failed++;
+  }
+  for (i = 0; i < MAX_SAMPLES; i++) {
+    v[i].x = v[i].y = v[i].z = (i & 1) ? 32767 : -32767;
+  }
+  round_trip("extremes", v, MAX_SAMPLES, true);
+  round_trip("extremes", v, 1, true);
+}
+
+// runs of continuation bytes past 32 bits, and ones cut short
+static void test_varints() {
+  uint8_t buf[8];
+  DataVec v;
+  uint32_t d;
+  int n;
+  memset(buf, 0x80, sizeof(buf));
+  if (codec_get_varint(buf, sizeof(buf), &d) != 0 || codec_decode(buf, sizeof(buf), &v, 1) != 0) {
+    fprintf(stderr, "varints: read a varint that never ends\n");
+    failed++;
+  }
+  n = codec_put_varint(buf, 0xffffffffu);
+  if (n != 5 || codec_get_varint(buf, n, &d) != n || d != 0xffffffffu || codec_get_varint(buf, n-1, &d) != 0) {
+    fprintf(stderr, "varints: 0xffffffff came back as %u in %d bytes\n", (unsigned)d, n);
+    failed++;
+  }
+}
+
+static void test_random() {
+  DataVec v[MAX_SAMPLES];
+  int round, n, i, step;
+  for (round = 0; round < ROUNDS; round++) {
+    n = 1 + rnd(MAX_SAMPLES);
+    step = 1 << rnd(17);
+    v[0] = (DataVec) { rnd(65536)-32768, rnd(65536)-32768, rnd(65536)-32768 };
+    for (i = 1; i < n; i++) {
+      v[i].x = v[i-1].x + rnd(step) - step/2;
+      v[i].y = v[i-1].y + rnd(step) - step/2;
+      v[i].z = v[i-1].z + rnd(step) - step/2;
+    }
+    round_trip("random", v, n, round % 50 == 0);
+  }
+}
+
+int main() {
+  test_empty();
+  test_extremes();
+  test_varints();
+  test_random();
+  printf("codec_test: %d random rounds, %d failed\n", ROUNDS, failed);
+  return failed != 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * fixed_test.c
+ * Bounds the fixed-point pipeline's error against float on the same
+ * traces. The moving-average filter's stillness energy must stay within
+ * 2(|x_diff| + |y_diff| + |z_diff|) + 3 of the float filter's, as gesture.c
+ * claims, and the squared error scores within rounding of the exact mean.
+ * Includes gesture.c to reach its static filter and scoring, and sets
+ * GESTURE_FIXED_POINT=1 and GESTURE_KALMAN=0 for it; the scores are only
+ * checked for the shift matchers:
+ *
+ *   make -C host check
+ */
+
+// whatever the build asks for, the engine under test is this one
+#undef GESTURE_FIXED_POINT
+#define GESTURE_FIXED_POINT 1
+#undef GESTURE_KALMAN
+#define GESTURE_KALMAN 0
+
+#include "../src/gesture.c"
+#include <math.h>
+#include "rng.h"
+
+#define TRACE_SAMPLES 200000
+
+static int16_t clamp_mg(int v) {
+  return v > 4000 ? 4000 : (v < -4000 ? -4000 : v);
+}
+
+// a wrist at rest, moving, shaken and slammed into the range limits, in
+// stretches of random length
+static void trace_sample(AccelData *a) {
+  static int kind, left, x, y, z;
+  if (left-- <= 0) {
+    kind = rnd(4);
+    left = 10 + rnd(200);
+  }
+  switch (kind) {
+  case 0: // at rest, tilted
+    a->x = clamp_mg(x + rnd(21)-10);
+    a->y = clamp_mg(y + rnd(21)-10);
+    a->z = clamp_mg(z + rnd(21)-10 - 1000);
+    break;
+  case 1: // a gesture
+    x = clamp_mg(x + rnd(401)-200);
+    y = clamp_mg(y + rnd(401)-200);
+    z = clamp_mg(z + rnd(401)-200);
+    a->x = x;
+    a->y = y;
+    a->z = clamp_mg(z - 1000);
+    break;
+  case 2: // vibration
+    a->x = clamp_mg(x + rnd(801)-400);
+    a->y = clamp_mg(y + rnd(801)-400);
+    a->z = clamp_mg(z + rnd(801)-400 - 1000);
+    break;
+  default: // knocks to the range limits
+    a->x = rnd(2) ? 4000 : -4000;
+    a->y = rnd(2) ? 4000 : -4000;
+    a->z = rnd(2) ? 4000 : -4000;
+    break;
+  }
+}
+
+// the float filter of GESTURE_FIXED_POINT=0, with its residuals
+static float fx, fy, fz;
+
+static float float_filter(AccelData *a, float *bound) {
+  const float alpha = 0.1;
+  float dx, dy, dz;
+  fx = fx + alpha*((float)a->x - fx);
+  fy = fy + alpha*((float)a->y - fy);
+  fz = fz + alpha*((float)a->z - fz);
+  dx = (float)a->x - fx;
+  dy = (float)a->y - fy;
+  dz = (float)a->z - fz;
+  // each fixed residual is within 1 mG of its float one
+  *bound = 2*(fabsf(dx) + fabsf(dy) + fabsf(dz)) + 3;
+  return dx*dx + dy*dy + dz*dz;
+}
+
+static int test_filter() {
+  AccelData a = { 0 };
+  DataVec v;
+  float want, bound, err, worst = 0;
+  int i, failed = 0;
+  energy_t got;
+
+  trace_sample(&a);
+  filter_reset(&a);
+  fx = a.x;
+  fy = a.y;
+  fz = a.z;
+  for (i = 0; i < TRACE_SAMPLES; i++) {
+    got = filter(&a, &v);
+    want = float_filter(&a, &bound);
+    // float itself carries a relative error of a few ulps
+    err = fabsf((float)got - want);
+    if (err > bound + want*1e-6f) {
+      if (failed++ < 10) {
+        fprintf(stderr, "sample %d: fixed %ld float %.1f, off by %.1f over %.1f\n", i, (long)got, want, err, bound);
+      }
+    }
+    if (want < 2*still_floor && err > worst) {
+      worst = err;
+    }
+    trace_sample(&a);
+  }
+  printf("fixed_test: filter over %d samples, %d past the bound, worst %.0f near the threshold (%.2f%% of still_floor)\n",
+         TRACE_SAMPLES, failed, worst, 100*worst/still_floor);
+  return failed;
+}
+
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+static int test_scores() {
+  DataVec ring[MAX_BUFF_SIZE], ref[MAX_REF_SIZE];
+  Span span;
+  energy_t got;
+  double want;
+  int round, size, delay, j, n, failed = 0;
+
+  for (round = 0; round < 100000; round++) {
+    for (j = 0; j < MAX_BUFF_SIZE; j++) {
+      ring[j] = (DataVec) { rnd(8001)-4000, rnd(8001)-4000, rnd(8001)-4000 };
+    }
+    size = 1 + rnd(MAX_REF_SIZE);
+    for (j = 0; j < size; j++) {
+      ref[j] = (DataVec) { rnd(8001)-4000, rnd(8001)-4000, rnd(8001)-4000 };
+    }
+    span = (Span) { .ring = ring, .cap = MAX_BUFF_SIZE, .start = rnd(MAX_BUFF_SIZE), .size = 1 + rnd(MAX_BUFF_SIZE) };
+    delay = rnd(span.size + size) - size + 1;
+    if (!span_error(&span, ref, size, delay, &got)) {
+      continue;
+    }
+    want = 0;
+    n = 0;
+    for (j = max(0,delay); j < min(span.size,size+delay); j++, n++) {
+      DataVec *a = &ref[j-delay], *b = span_at(&span, j);
+      want += (double)(a->x-b->x)*(a->x-b->x) + (double)(a->y-b->y)*(a->y-b->y) + (double)(a->z-b->z)*(a->z-b->z);
+    }
+    want /= n;
+    // the mean is truncated to a whole squared mG
+    if (got > want || got <= want - 1) {
+      if (failed++ < 10) {
+        fprintf(stderr, "round %d: score %ld for %.2f\n", round, (long)got, want);
+      }
+    }
+  }
+  printf("fixed_test: scores, %d outside rounding\n", failed);
+  return failed;
+}
+#else
+static int test_scores() {
+  return 0;
+}
+#endif
+
+int main() {
+  return (test_filter() + test_scores()) != 0;
+}
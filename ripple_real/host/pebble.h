@@ -0,0 +1,50 @@
+/*
+ * pebble.h
+ * Desktop stand-in for the parts of the Pebble SDK header that the gesture
+ * engine uses, so it can be built and profiled off the watch; host/Makefile
+ * builds replay and the host tests against it:
+ *
+ *   make -C host check
+ *
+ * Define HOST_LOG_LEVEL (e.g. -DHOST_LOG_LEVEL=APP_LOG_LEVEL_INFO) to see
+ * more of the engine's APP_LOG output on stderr.
+ */
+
+#pragma once
+
+// lets portable code pick a desktop clock
+#define PEBBLE_HOST 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// same packed layout as the SDK, so raw AccelData buffers read as-is
+typedef struct __attribute__((__packed__)) {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+  bool did_vibrate;
+  uint64_t timestamp;
+} AccelData;
+
+typedef enum {
+  APP_LOG_LEVEL_ERROR = 1,
+  APP_LOG_LEVEL_WARNING = 50,
+  APP_LOG_LEVEL_INFO = 100,
+  APP_LOG_LEVEL_DEBUG = 200,
+  APP_LOG_LEVEL_DEBUG_VERBOSE = 255,
+} AppLogLevel;
+
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL APP_LOG_LEVEL_ERROR
+#endif
+
+#define APP_LOG(level, fmt, args...) \
+  do { \
+    if ((level) <= HOST_LOG_LEVEL) { \
+      fprintf(stderr, "%s:%d " fmt "\n", __FILE__, __LINE__, ## args); \
+    } \
+  } while (0)
@@ -0,0 +1,419 @@
+/*
+ * replay.c
+ * Replays a recorded accelerometer trace through the gesture engine on a
+ * desktop and reports throughput, per-tick latency and every event.
+ *
+ *   make -C host replay
+ *   ./replay [-g templates.bin] [-t num] [-s] [-o templates.bin] [-e reps.bin] [-w weights.bin] [-b batch] [-r repeat] [-c] [-q] trace.bin
+ *
+ * -b groups that many samples into one tick, as the watch's batched
+ * accelerometer callback does, and latency is reported per tick. Build with
+ * -DGESTURE_MATCHER=0 or 2 to compare the batch or DTW matcher against the
+ * default streaming one: the summary gives how many motions were found and
+ * missed, the time of the samples that decided them, and the time per motion
+ * over the whole run.
+ *
+ * A trace is packed little-endian AccelData records (x, y, z, did_vibrate,
+ * timestamp), 15 bytes each: the bodies the ripple app's phone side
+ * uploads, which ripple/tools/collector.py --trace saves. Use - to read it
+ * from stdin.
+ *
+ * -c also codes the trace's x, y, z with the wire codec in messages of
+ * CODEC_MESSAGE samples, checks that they decode to the same values and
+ * reports the bytes per sample.
+ *
+ * Templates come either from a file of (uint32 size, size DataVec) records,
+ * the same bytes that arrive as KEY_OLD_GESTURE_DATA_SIZE / _DATA, or are
+ * trained from the first 3*num motions of the trace with -t. -s trains each
+ * one as a session, gesture_make_session(), instead of a repetition at a
+ * time. -o writes the library as it stands at the end in the same format,
+ * and -e every training repetition as it was captured, gesture by gesture;
+ * host/train_linear.py trains the classifier from the two, and -w loads
+ * the weights it writes, the value of KEY_CLASSIFIER.
+ *
+ * Built with -DGESTURE_PROFILE=1 it also prints the engine's own per-phase
+ * timings from profile.h, in us.
+ */
+
+#include <pebble.h>
+#include <time.h>
+#include "gesture.h"
+#include "codec.h"
+#include "profile.h"
+#include "store.h"
+#include "classify.h"
+
+#define TRACE_RECORD_SIZE 15
+#define READ_SAMPLES 1024
+#define LATENCY_BUCKETS 32 // powers of two of nanoseconds
+#define CODEC_MESSAGE 25 // samples per message, a second of the ripple app's data
+
+static uint64_t latency_hist[LATENCY_BUCKETS];
+static uint64_t ticks;
+static uint64_t latency_min = UINT64_MAX;
+static uint64_t latency_max;
+static uint64_t latency_total;
+static uint64_t samples;
+static uint64_t found;
+static uint64_t missed;
+static uint64_t adapted;
+static uint64_t decide_total;
+static uint64_t decide_max;
+static int train_left;
+static bool train_session;
+static FILE *reps_out;
+static bool quiet;
+static DataVec codec_in[CODEC_MESSAGE];
+static int codec_n;
+static uint64_t codec_samples;
+static uint64_t codec_bytes;
+static bool codec_failed;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record_latency(uint64_t ns) {
+  int b = 0;
+  while (b < LATENCY_BUCKETS-1 && (ns >> (b+1)) != 0) {
+    b++;
+  }
+  latency_hist[b]++;
+  latency_total += ns;
+  ticks++;
+  if (ns < latency_min) {
+    latency_min = ns;
+  }
+  if (ns > latency_max) {
+    latency_max = ns;
+  }
+}
+
+// upper edge of the bucket holding the given fraction of all ticks
+static uint64_t latency_percentile(double p) {
+  uint64_t want = (uint64_t)(p*ticks), seen = 0;
+  int b;
+  for (b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += latency_hist[b];
+    if (seen > want) {
+      break;
+    }
+  }
+  return 2ull << b;
+}
+
+static void decode(const uint8_t *rec, AccelData *accel) {
+  int i;
+  accel->x = (int16_t)(rec[0] | rec[1] << 8);
+  accel->y = (int16_t)(rec[2] | rec[3] << 8);
+  accel->z = (int16_t)(rec[4] | rec[5] << 8);
+  accel->did_vibrate = rec[6] != 0;
+  accel->timestamp = 0;
+  for (i = 7; i >= 0; i--) {
+    accel->timestamp = accel->timestamp << 8 | rec[7+i];
+  }
+}
+
+// codes a message of samples and checks they come back unchanged
+static void codec_flush() {
+  uint8_t buf[CODEC_MAX_BYTES(CODEC_MESSAGE)];
+  DataVec out[CODEC_MESSAGE];
+  int len = codec_encode(codec_in, codec_n, buf, sizeof(buf));
+  if (codec_n == 0) {
+    return;
+  }
+  if (len == 0 || codec_decode(buf, len, out, codec_n) != len || memcmp(out, codec_in, sizeof(DataVec)*codec_n)) {
+    if (!codec_failed) {
+      fprintf(stderr, "codec: round trip failed in the message at sample %llu\n", (unsigned long long)codec_samples);
+    }
+    codec_failed = true;
+  }
+  codec_samples += codec_n;
+  codec_bytes += len;
+  codec_n = 0;
+}
+
+static void codec_add(AccelData *accel) {
+  codec_in[codec_n].x = accel->x;
+  codec_in[codec_n].y = accel->y;
+  codec_in[codec_n].z = accel->z;
+  if (++codec_n == CODEC_MESSAGE) {
+    codec_flush();
+  }
+}
+
+// one (uint32 size, size DataVec) record, the format of -g, -o and -e
+static void write_record(FILE *f, DataVec *data, int size) {
+  uint8_t size_le[4] = { size, 0, 0, 0 };
+  fwrite(size_le, 1, 4, f);
+  fwrite(data, sizeof(DataVec), size, f);
+}
+
+static void save_rep() {
+  DataVec data[MAX_REF_SIZE];
+  if (reps_out) {
+    write_record(reps_out, data, gesture_last_rep(data));
+  }
+}
+
+static void report(GestureEvent event, uint64_t index, AccelData *accel) {
+  switch (event) {
+  case GESTURE_GO:
+    if (!quiet) {
+      printf("%llu\t%llu\tgo\n", (unsigned long long)index, (unsigned long long)accel->timestamp);
+    }
+    break;
+  case GESTURE_REF_DONE:
+    if (!quiet) {
+      printf("%llu\t%llu\tref\n", (unsigned long long)index, (unsigned long long)accel->timestamp);
+    }
+    save_rep();
+    if (!train_session) {
+      gesture_make();
+    }
+    break;
+  case GESTURE_MADE:
+    printf("%llu\t%llu\tmade %d size %d\n", (unsigned long long)index, (unsigned long long)accel->timestamp,
+           gesture_count()-1, store_size(gesture_count()-1));
+    save_rep();
+    if (--train_left > 0) {
+      train_session ? gesture_make_session() : gesture_make();
+    }
+    break;
+  case GESTURE_FOUND:
+    printf("%llu\t%llu\tfound %d\n", (unsigned long long)index, (unsigned long long)accel->timestamp, gesture_found());
+    break;
+  case GESTURE_MISSED:
+    if (!quiet) {
+      printf("%llu\t%llu\tmissed\n", (unsigned long long)index, (unsigned long long)accel->timestamp);
+    }
+    break;
+  case GESTURE_NONE:
+    break;
+  }
+}
+
+static bool load_templates(const char *path) {
+  DataVec data[MAX_REF_SIZE];
+  uint8_t size_le[4];
+  uint32_t size;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  while (fread(size_le, 1, 4, f) == 4) {
+    size = size_le[0] | size_le[1] << 8 | size_le[2] << 16 | (uint32_t)size_le[3] << 24;
+    if (size > MAX_REF_SIZE || fread(data, sizeof(DataVec), size, f) != size || !gesture_add(data, size, 0)) {
+      fprintf(stderr, "%s: bad template %d\n", path, gesture_count());
+      fclose(f);
+      return false;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static bool save_templates(const char *path) {
+  DataVec data[MAX_REF_SIZE];
+  int i;
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  for (i = 0; i < gesture_count(); i++) {
+    write_record(f, data, gesture_get(i, data));
+  }
+  return fclose(f) == 0;
+}
+
+static bool load_weights(const char *path) {
+  uint8_t buf[CLASSIFY_PACKED_MAX];
+  size_t len;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  if (!classify_unpack(buf, len)) {
+    fprintf(stderr, "%s: not weights for %d features\n", path, FEATURE_COUNT);
+    return false;
+  }
+  return true;
+}
+
+#if GESTURE_PROFILE
+static void print_profile() {
+  const ProfileStats *st;
+  int p, b;
+  for (p = 0; p < PROFILE_PHASES; p++) {
+    st = profile_stats(p);
+    if (st->count == 0) {
+      continue;
+    }
+    fprintf(stderr, "%s us: runs %lu mean %.2f min %lu max %lu\n", profile_name(p), (unsigned long)st->count,
+            (double)st->total/st->count, (unsigned long)st->min, (unsigned long)st->max);
+    for (b = 0; b < PROFILE_BUCKETS; b++) {
+      if (st->hist[b]) {
+        fprintf(stderr, "  <%6d us %lu\n", 1 << b, (unsigned long)st->hist[b]);
+      }
+    }
+  }
+}
+#endif
+
+static void usage() {
+  fprintf(stderr, "usage: replay [-g templates.bin] [-t num] [-s] [-o templates.bin] [-e reps.bin] [-w weights.bin] [-b batch] [-r repeat] [-c] [-q] trace.bin\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  static uint8_t buf[READ_SAMPLES*TRACE_RECORD_SIZE];
+  const char *templates = NULL, *trace = NULL, *out = NULL, *reps = NULL, *weights = NULL;
+  int repeat = 1, batch = 1, pass, i;
+  bool codec = false;
+  size_t n, k;
+  uint64_t index = 0, start, t0, ns, tick = 0, elapsed = 0;
+  AccelData accel;
+  GestureEvent event;
+  FILE *f;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-g") && i+1 < argc) {
+      templates = argv[++i];
+    } else if (!strcmp(argv[i], "-o") && i+1 < argc) {
+      out = argv[++i];
+    } else if (!strcmp(argv[i], "-e") && i+1 < argc) {
+      reps = argv[++i];
+    } else if (!strcmp(argv[i], "-w") && i+1 < argc) {
+      weights = argv[++i];
+    } else if (!strcmp(argv[i], "-t") && i+1 < argc) {
+      train_left = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-b") && i+1 < argc) {
+      batch = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-r") && i+1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-s")) {
+      train_session = true;
+    } else if (!strcmp(argv[i], "-c")) {
+      codec = true;
+    } else if (!strcmp(argv[i], "-q")) {
+      quiet = true;
+    } else if (!trace) {
+      trace = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (!trace || batch < 1) {
+    usage();
+  }
+
+  gesture_init();
+  if (templates && !load_templates(templates)) {
+    return 1;
+  }
+  if (weights && !load_weights(weights)) {
+    return 1;
+  }
+  if (reps && !(reps_out = fopen(reps, "wb"))) {
+    perror(reps);
+    return 1;
+  }
+  if (train_left > 0) {
+    train_session ? gesture_make_session() : gesture_make();
+  }
+
+  printf("sample\ttimestamp\tevent\n");
+  for (pass = 0; pass < repeat; pass++) {
+    f = strcmp(trace, "-") ? fopen(trace, "rb") : stdin;
+    if (!f) {
+      perror(trace);
+      return 1;
+    }
+    while ((n = fread(buf, TRACE_RECORD_SIZE, READ_SAMPLES, f)) > 0) {
+      start = now_ns();
+      for (k = 0; k < n; k++) {
+        decode(&buf[k*TRACE_RECORD_SIZE], &accel);
+        if (codec && pass == 0) {
+          codec_add(&accel);
+        }
+        t0 = now_ns();
+        event = gesture_process(&accel);
+        ns = now_ns()-t0;
+        tick += ns;
+        if (event == GESTURE_FOUND) {
+          found++;
+          adapted += gesture_adapted() >= 0;
+        } else if (event == GESTURE_MISSED) {
+          missed++;
+        }
+        if (event == GESTURE_FOUND || event == GESTURE_MISSED) {
+          decide_total += ns;
+          if (ns > decide_max) {
+            decide_max = ns;
+          }
+        }
+        if (++samples % batch == 0) {
+          record_latency(tick);
+          tick = 0;
+        }
+        if (event != GESTURE_NONE) {
+          report(event, index, &accel);
+        }
+        index++;
+      }
+      elapsed += now_ns()-start;
+    }
+    if (f != stdin) {
+      fclose(f);
+    }
+  }
+
+  if (out && !save_templates(out)) {
+    return 1;
+  }
+  if (reps_out && fclose(reps_out) != 0) {
+    perror(reps);
+    return 1;
+  }
+  if (!ticks) {
+    fprintf(stderr, "%s: fewer than %d samples\n", trace, batch);
+    return 1;
+  }
+  fprintf(stderr, "samples: %llu (%.1f h at 25 Hz)\n", (unsigned long long)samples, samples/25.0/3600.0);
+  fprintf(stderr, "throughput: %.0f samples/s\n", samples/(elapsed*1e-9));
+  fprintf(stderr, "ticks: %llu of %d samples\n", (unsigned long long)ticks, batch);
+  fprintf(stderr, "latency ns: min %llu mean %llu p50 <%llu p99 <%llu p99.9 <%llu max %llu\n",
+          (unsigned long long)latency_min, (unsigned long long)(latency_total/ticks),
+          (unsigned long long)latency_percentile(0.5), (unsigned long long)latency_percentile(0.99),
+          (unsigned long long)latency_percentile(0.999), (unsigned long long)latency_max);
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    if (latency_hist[i]) {
+      fprintf(stderr, "  <%10llu ns %llu\n", 2ull << i, (unsigned long long)latency_hist[i]);
+    }
+  }
+  if (codec) {
+    codec_flush();
+    fprintf(stderr, "codec: %llu samples in %llu bytes, %.2f bytes a sample against 6 raw, round trip %s\n",
+            (unsigned long long)codec_samples, (unsigned long long)codec_bytes,
+            (double)codec_bytes/codec_samples, codec_failed ? "FAILED" : "ok");
+  }
+  if (found+missed) {
+    fprintf(stderr, "motions: %llu found %llu (%.1f%%) missed %llu\n", (unsigned long long)(found+missed),
+            (unsigned long long)found, 100.0*found/(found+missed), (unsigned long long)missed);
+    fprintf(stderr, "adapted: %llu matches\n", (unsigned long long)adapted);
+    fprintf(stderr, "decision ns: mean %llu max %llu, per motion overall %llu\n",
+            (unsigned long long)(decide_total/(found+missed)), (unsigned long long)decide_max,
+            (unsigned long long)(latency_total/(found+missed)));
+  }
+#if GESTURE_PROFILE
+  print_profile();
+#endif
+  return codec_failed;
+}
@@ -0,0 +1,19 @@
+/*
+ * rng.h
+ * The host tests' random numbers: a fixed-seed xorshift, so that a failing
+ * round comes back the same on every run.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+static uint32_t rng = 2463534242u;
+
+// 0 to n-1
+static inline int rnd(int n) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % n;
+}
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+train_linear.py
+Phone-side training of the watch's linear classifier (src/classify.h),
+for trying it out on a laptop. Reads a template library and, better, the
+repetitions it was made from, both in replay's -g / -o / -e format (uint32
+size, then size int16 x, y, z samples, little-endian; the repetitions
+gesture by gesture, the same number of each). Each one and jittered copies
+of it stand for the gesture, random motions for the junk, and a
+multinomial logistic regression over the gestures and the junk is fitted
+to the features of src/feature.c. Every gesture's weights come out less
+the junk's, so a gesture scores above zero where it beats the junk, and
+are the value of KEY_CLASSIFIER:
+
+    ./replay -t 9 -o templates.bin -e reps.bin training.bin
+    python3 train_linear.py templates.bin weights.bin [--reps reps.bin] [--copies 200] [--seed 1]
+    ./replay -g templates.bin -w weights.bin trace.bin
+"""
+
+import argparse
+import math
+import random
+import struct
+
+# src/feature.h
+SEGMENTS = 4
+DEADBAND = 64
+STORE_SHIFT = 5
+COUNT = 3*SEGMENTS + 3 + 3 + 1
+PRE_ROLL = 3
+POST_ROLL = 2
+
+
+def clamp8(v):
+    return max(-128, min(127, v))
+
+
+def scaled_mean(total, n):
+    # C division truncates towards zero
+    d = n << STORE_SHIFT
+    if total >= 0:
+        return clamp8((total + d//2)//d)
+    return clamp8(-((-total + d//2)//d))
+
+
+def features(ges):
+    """src/feature.c features_extract(), exactly"""
+    n = len(ges)
+    f = [0]*COUNT
+    mag = [0, 0, 0]
+    sign = [0, 0, 0]
+    count = [0, 0, 0]
+    for s in range(SEGMENTS):
+        lo, hi = s*n//SEGMENTS, (s+1)*n//SEGMENTS
+        total = [0, 0, 0]
+        for v in ges[lo:hi]:
+            for a in range(3):
+                total[a] += v[a]
+                mag[a] += abs(v[a])
+                c = 1 if v[a] > DEADBAND else (-1 if v[a] < -DEADBAND else 0)
+                if c:
+                    if sign[a] and c != sign[a] and count[a] < 127:
+                        count[a] += 1
+                    sign[a] = c
+        for a in range(3):
+            f[3*s + a] = scaled_mean(total[a], hi-lo) if hi > lo else 0
+    for a in range(3):
+        f[3*SEGMENTS + a] = scaled_mean(mag[a], n) if n else 0
+        f[3*SEGMENTS + 3 + a] = count[a]
+    f[3*SEGMENTS + 6] = clamp8(n)
+    return f
+
+
+def load(path):
+    data = open(path, 'rb').read()
+    lib, at = [], 0
+    while at + 4 <= len(data):
+        size, = struct.unpack_from('<I', data, at)
+        at += 4
+        lib.append([struct.unpack_from('<hhh', data, at + 6*j) for j in range(size)])
+        at += 6*size
+    return lib
+
+
+def still(k):
+    return [tuple(random.gauss(0, 15) for _ in range(3)) for _ in range(k)]
+
+
+def jitter(t):
+    """t as the watch would capture it another time: at another tempo, size
+    and noise, with the still samples around it"""
+    rate = random.uniform(0.75, 1.35)
+    gain = random.uniform(0.8, 1.2)
+    n = max(2, min(45, round(len(t)*rate)))
+    out = []
+    for j in range(n):
+        p = j*(len(t) - 1)/max(1, n - 1)
+        i = min(int(p), len(t) - 2) if len(t) > 1 else 0
+        w = p - i
+        b = t[i + 1] if len(t) > 1 else t[i]
+        out.append(tuple(int(gain*((1 - w)*t[i][a] + w*b[a]) + random.gauss(0, 40)) for a in range(3)))
+    return still(PRE_ROLL) + out + still(POST_ROLL)
+
+
+def junk():
+    """a motion that is none of the gestures"""
+    n = random.randint(8, 45)
+    waves = [(random.uniform(0, 900), random.uniform(0.1, 1.0), random.uniform(0, 2*math.pi)) for _ in range(3)]
+    return still(PRE_ROLL) + [tuple(int(a*math.sin(j*f + p) + random.gauss(0, 40)) for a, f, p in waves)
+                              for j in range(n)] + still(POST_ROLL)
+
+
+def train_softmax(xs, ys, classes, epochs=30, rate=0.05, lam=1e-4):
+    """multinomial logistic regression by stochastic gradient descent, with
+    a bias as the last weight"""
+    w = [[0.0]*(len(xs[0]) + 1) for _ in range(classes)]
+    order = list(range(len(xs)))
+    for _ in range(epochs):
+        random.shuffle(order)
+        for i in order:
+            x = xs[i] + [1.0]
+            s = [sum(a*b for a, b in zip(wc, x)) for wc in w]
+            top = max(s)
+            p = [math.exp(v - top) for v in s]
+            z = sum(p)
+            for c in range(classes):
+                g = p[c]/z - (1 if c == ys[i] else 0)
+                w[c] = [a - rate*(g*b + lam*a) for a, b in zip(w[c], x)]
+    return w
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('templates')
+    ap.add_argument('weights')
+    ap.add_argument('--reps')
+    ap.add_argument('--copies', type=int, default=200)
+    ap.add_argument('--seed', type=int, default=1)
+    args = ap.parse_args()
+    random.seed(args.seed)
+
+    lib = load(args.templates)
+    if not lib or len(lib) > 255:
+        raise SystemExit('%s: need 1 to 255 templates' % args.templates)
+    # the repetitions come with their still samples, so those are dropped
+    # before jittering
+    examples = [[(t, t)] for t in lib]
+    if args.reps:
+        reps = load(args.reps)
+        n = len(reps)//len(lib)
+        if n == 0 or n*len(lib) != len(reps):
+            raise SystemExit('%s: need the same number of repetitions of every template' % args.reps)
+        examples = [[(r, r[PRE_ROLL:len(r) - POST_ROLL] or r) for r in reps[c*n:(c + 1)*n]] for c in range(len(lib))]
+    samples = []
+    for c, ex in enumerate(examples):
+        for k in range(args.copies):
+            whole, core = ex[k % len(ex)]
+            samples.append((features(whole if k < len(ex) and args.reps else jitter(core)), c))
+    samples += [(features(junk()), -1) for _ in range(args.copies*3)]
+
+    # standardised for training, folded back into the raw features after
+    mean = [sum(f[k] for f, _ in samples)/len(samples) for k in range(COUNT)]
+    std = [max(1e-3, math.sqrt(sum((f[k] - mean[k])**2 for f, _ in samples)/len(samples))) for k in range(COUNT)]
+    xs = [[(f[k] - mean[k])/std[k] for k in range(COUNT)] for f, _ in samples]
+    # one class more for the junk, whose score every gesture's is taken
+    # from, so that a gesture scoring above zero beats the junk
+    w = train_softmax(xs, [label if label >= 0 else len(lib) for _, label in samples], len(lib) + 1)
+    raw = []
+    for c in range(len(lib)):
+        wk = [(w[c][k] - w[-1][k])/std[k] for k in range(COUNT)]
+        raw.append((w[c][-1] - w[-1][-1] - sum(wk[k]*mean[k] for k in range(COUNT)), wk))
+
+    # one scale for every class keeps the scores comparable
+    scale = 127/max(abs(v) for _, wk in raw for v in wk)
+    out = struct.pack('<BB', len(lib), COUNT)
+    for bias, wk in raw:
+        out += struct.pack('<i', round(bias*scale)) + struct.pack('<%db' % COUNT, *[round(v*scale) for v in wk])
+    open(args.weights, 'wb').write(out)
+
+    right = sum(1 for f, label in samples
+                if max(range(len(lib)), key=lambda c: raw[c][0] + sum(a*b for a, b in zip(raw[c][1], f))) == label
+                or (label < 0 and max(raw[c][0] + sum(a*b for a, b in zip(raw[c][1], f)) for c in range(len(lib))) <= 0))
+    print('%d classes, %d features, %d bytes, %.1f%% of the training set right' % (
+        len(lib), COUNT, len(out), 100.0*right/len(samples)))
+
+
+if __name__ == '__main__':
+    main()
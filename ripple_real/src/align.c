@@ -0,0 +1,262 @@
+/*
+ * align.c
+ * Cross-correlation alignment of a captured motion against a reference.
+ */
+
+#include "align.h"
+
+#define max(a,b) (((a)>(b))?(a):(b))
+#define min(a,b) ((a>b)?(b):(a))
+#define abs(a) (((a)>0)?(a):(-(a)))
+
+// per-axis state of an align() scan
+typedef struct {
+  int max;
+  int min;
+  int del; // lag of max, the lowest lag wins ties
+  uint32_t e1[2]; // energy of the positive [0] and negative [1] ges1 samples in the overlap
+  uint32_t e2[2]; // same for ges2
+} AxisScan;
+
+static void scan_update(AxisScan *s, int sum, int lag) {
+  if (sum > s->max || (sum == s->max && lag < s->del)) {
+    s->max = sum;
+    s->del = lag;
+  }
+  if (sum < s->min) {
+    s->min = sum;
+  }
+}
+
+// square of a bound on sqrt(p) + sqrt(q)
+static uint64_t bound2(uint64_t p, uint64_t q) {
+  return (p == 0 || q == 0) ? p+q : 2*(p+q);
+}
+
+// true if the correlation at lag cannot move min or max. Splitting each
+// overlap into its positive and negative samples bounds the correlation
+// from above and below by Cauchy-Schwarz.
+static bool scan_skip(const AxisScan *s, int lag) {
+  uint64_t up, down;
+  if (s->max < 0 || s->min > 0) {
+    return false;
+  }
+  down = bound2((uint64_t)s->e1[0]*s->e2[1], (uint64_t)s->e1[1]*s->e2[0]);
+  if (down > (uint64_t)((int64_t)s->min*s->min)) {
+    return false;
+  }
+  up = bound2((uint64_t)s->e1[0]*s->e2[0], (uint64_t)s->e1[1]*s->e2[1]);
+  if (lag < s->del) { // an equal maximum at a lower lag would take over
+    return up < (uint64_t)((int64_t)s->max*s->max);
+  }
+  return up <= (uint64_t)((int64_t)s->max*s->max);
+}
+
+static void energy_add(uint32_t *e, int v) {
+  e[v < 0] += v*v;
+}
+
+static void energy_sub(uint32_t *e, int v) {
+  e[v < 0] -= v*v;
+}
+
+static void overlap_add1(AxisScan *s, const DataVec *v) {
+  energy_add(s[0].e1, v->x);
+  energy_add(s[1].e1, v->y);
+  energy_add(s[2].e1, v->z);
+}
+
+static void overlap_sub1(AxisScan *s, const DataVec *v) {
+  energy_sub(s[0].e1, v->x);
+  energy_sub(s[1].e1, v->y);
+  energy_sub(s[2].e1, v->z);
+}
+
+static void overlap_add2(AxisScan *s, const DataVec *v) {
+  energy_add(s[0].e2, v->x);
+  energy_add(s[1].e2, v->y);
+  energy_add(s[2].e2, v->z);
+}
+
+static void overlap_sub2(AxisScan *s, const DataVec *v) {
+  energy_sub(s[0].e2, v->x);
+  energy_sub(s[1].e2, v->y);
+  energy_sub(s[2].e2, v->z);
+}
+
+static void dot(const DataVec *a, const DataVec *b, int n, int *sumx, int *sumy, int *sumz) {
+  int j;
+  for (j = 0; j < n; j++) {
+    *sumx += a[j].x*b[j].x;
+    *sumy += a[j].y*b[j].y;
+    *sumz += a[j].z*b[j].z;
+  }
+}
+
+static void align_lag(AxisScan *s, const Span *ges1, const DataVec *ges2, int size2, int i) {
+  int a = max(0,i), b = min(ges1->size,i+size2);
+  int wrap = ges1->cap-ges1->start; // ges1 index that wraps to ring[0]
+  int sumx = 0, sumy = 0, sumz = 0;
+  if (scan_skip(&s[0], i) && scan_skip(&s[1], i) && scan_skip(&s[2], i)) {
+    return;
+  }
+  if (a < wrap) {
+    dot(&ges1->ring[ges1->start+a], &ges2[a-i], min(b,wrap)-a, &sumx, &sumy, &sumz);
+  }
+  if (b > wrap) {
+    a = max(a,wrap);
+    dot(&ges1->ring[a-wrap], &ges2[a-i], b-a, &sumx, &sumy, &sumz);
+  }
+  scan_update(&s[0], sumx, i);
+  scan_update(&s[1], sumy, i);
+  scan_update(&s[2], sumz, i);
+}
+
+// delay of the axis whose correlation has the largest spread
+static int scan_delay(AxisScan *s) {
+  int del, maxd, dy, dz;
+  del = s[0].del;
+  maxd = abs(s[0].max-s[0].min);
+  dy = abs(s[1].max-s[1].min);
+  dz = abs(s[2].max-s[2].min);
+  if (dy > maxd) {
+    del = s[1].del;
+    maxd = dy;
+  }
+  if (dz > maxd) {
+    del = s[2].del;
+  }
+  return del;
+}
+
+static void scan_init(AxisScan *s) {
+  memset(s, 0, 3*sizeof(AxisScan));
+  s[0].max = s[1].max = s[2].max = INT32_MIN;
+  s[0].min = s[1].min = s[2].min = INT32_MAX;
+}
+
+// Returns the delay of ges2 relative to ges1, taken from the axis whose
+// cross-correlation has the largest spread between min and max.
+// Lags are scanned outward from zero so the peaks are found early. The
+// energies of the overlapping samples are kept as running sums that change
+// by a sample or two between neighbouring lags, and any lag whose energy
+// bound cannot move a peak is skipped without computing its correlation.
+// Accelerometer values stay within +-4000 mG, so the energies fit in 32
+// bits and their products in 64.
+int align_span(Span *ges1, DataVec *ges2, int size2) {
+  AxisScan s[3];
+  int size1 = ges1->size;
+  int i, j, lo, hi;
+
+  if (size1 <= 0 || size2 <= 0) {
+    return 0;
+  }
+  lo = max(-size2+1, -ALIGN_MAX_LAG);
+  hi = min(size1+size2-1, ALIGN_MAX_LAG);
+
+  scan_init(s);
+  if (hi >= size1) { // lags past the end of ges1 have no overlap and sum to zero
+    scan_update(&s[0], 0, size1);
+    scan_update(&s[1], 0, size1);
+    scan_update(&s[2], 0, size1);
+  }
+
+  // lag 0 overlaps ges1[0..n) with ges2[0..n)
+  for (j = 0; j < min(size1,size2); j++) {
+    overlap_add1(s, span_at(ges1, j));
+    overlap_add2(s, &ges2[j]);
+  }
+  align_lag(s, ges1, ges2, size2, 0);
+
+  // lag i > 0 overlaps ges1[i..min(size1,i+size2)) with ges2[0..min(size2,size1-i))
+  for (i = 1; i <= min(hi,size1-1); i++) {
+    overlap_sub1(s, span_at(ges1, i-1));
+    if (i-1+size2 < size1) {
+      overlap_add1(s, span_at(ges1, i-1+size2));
+    }
+    if (size1-i < size2) {
+      overlap_sub2(s, &ges2[size1-i]);
+    }
+    align_lag(s, ges1, ges2, size2, i);
+  }
+
+  // lag i < 0 overlaps ges1[0..min(size1,i+size2)) with ges2[-i..min(size2,size1-i))
+  for (j = 0; j < 3; j++) {
+    s[j].e1[0] = s[j].e1[1] = s[j].e2[0] = s[j].e2[1] = 0;
+  }
+  for (j = 0; j < min(size1,size2); j++) {
+    overlap_add1(s, span_at(ges1, j));
+    overlap_add2(s, &ges2[j]);
+  }
+  for (i = -1; i >= lo; i--) {
+    if (i+size2 < size1) {
+      overlap_sub1(s, span_at(ges1, i+size2));
+    }
+    overlap_sub2(s, &ges2[-i-1]);
+    if (size1-i-1 < size2) {
+      overlap_add2(s, &ges2[size1-i-1]);
+    }
+    align_lag(s, ges1, ges2, size2, i);
+  }
+
+  return scan_delay(s);
+}
+
+int align(DataVec *ges1, int size1, DataVec *ges2, int size2) {
+  Span span = { .ring = ges1, .cap = size1, .start = 0, .size = size1 };
+  return align_span(&span, ges2, size2);
+}
+
+void align_stream_reset(AlignStream *st, int ref_size) {
+  st->ref_size = ref_size;
+  st->size = 0;
+  // negative lags; each later lag is cleared by the push that opens it
+  memset(st->sum, 0, sizeof(st->sum[0])*max(ref_size-1,0));
+}
+
+// capture sample j meets ref[j-l] at every lag l in (j-ref_size, j]
+void align_stream_push(AlignStream *st, const DataVec *v, const PackedVec *ref) {
+  int j = st->size, k;
+  int32_t *sum;
+  const PackedVec *r;
+  if (j >= MAX_BUFF_SIZE || st->ref_size <= 0) {
+    return;
+  }
+  memset(st->sum[j+st->ref_size-1], 0, sizeof(st->sum[0]));
+  for (k = 0; k < st->ref_size; k++) { // lag j-k meets ref[k]
+    r = &ref[k];
+    sum = st->sum[j-k+st->ref_size-1];
+    sum[0] += v->x*r->x;
+    sum[1] += v->y*r->y;
+    sum[2] += v->z*r->z;
+  }
+  st->size++;
+}
+
+// same lags and tie-breaks as align_span() over the pushed samples
+int align_stream_delay(AlignStream *st) {
+  AxisScan s[3];
+  int size1 = st->size, size2 = st->ref_size;
+  int i, lo, hi;
+  int32_t *sum;
+
+  if (size1 <= 0 || size2 <= 0) {
+    return 0;
+  }
+  lo = max(-size2+1, -ALIGN_MAX_LAG);
+  hi = min(size1+size2-1, ALIGN_MAX_LAG);
+
+  scan_init(s);
+  if (hi >= size1) {
+    scan_update(&s[0], 0, size1);
+    scan_update(&s[1], 0, size1);
+    scan_update(&s[2], 0, size1);
+  }
+  for (i = lo; i <= min(hi,size1-1); i++) {
+    sum = st->sum[i+size2-1];
+    scan_update(&s[0], sum[0], i);
+    scan_update(&s[1], sum[1], i);
+    scan_update(&s[2], sum[2], i);
+  }
+  return scan_delay(s);
+}
@@ -0,0 +1,45 @@
+/*
+ * align.h
+ * Cross-correlation alignment of a captured motion against a reference.
+ */
+
+#pragma once
+
+#include "gesture.h"
+#include "store.h"
+
+// size samples starting at ring[start], wrapping around after ring[cap-1]
+typedef struct {
+  DataVec *ring;
+  int cap;
+  int start;
+  int size;
+} Span;
+
+static inline DataVec *span_at(Span *span, int i) {
+  i += span->start;
+  return &span->ring[i >= span->cap ? i-span->cap : i];
+}
+
+// returns the delay of ges2 that best matches ges1, so ges1[j] lines up
+// with ges2[j-delay]
+int align(DataVec *ges1, int size1, DataVec *ges2, int size2);
+int align_span(Span *ges1, DataVec *ges2, int size2);
+
+// lags a capture of up to MAX_BUFF_SIZE samples has with a reference
+#define ALIGN_STREAM_LAGS (MAX_BUFF_SIZE + MAX_REF_SIZE - 1)
+
+// align_span() of a capture against a stored reference, built up one
+// capture sample at a time. Each push adds the sample's product with the
+// reference to every lag it overlaps, so align_stream_delay() only has to
+// find the peaks. The sums stay in stored units, which scales every lag
+// alike and leaves the peaks where they are.
+typedef struct {
+  int ref_size;
+  int size; // capture samples pushed so far
+  int32_t sum[ALIGN_STREAM_LAGS][3]; // x, y, z correlation at lag l, stored at l+ref_size-1
+} AlignStream;
+
+void align_stream_reset(AlignStream *st, int ref_size);
+void align_stream_push(AlignStream *st, const DataVec *v, const PackedVec *ref);
+int align_stream_delay(AlignStream *st);
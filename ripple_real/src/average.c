@@ -0,0 +1,123 @@
+/*
+ * average.c
+ * Shift-and-average template building with optional DTW barycenter
+ * refinement.
+ */
+
+#include "average.h"
+#include "align.h"
+#include "dtw.h"
+
+#define max(a,b) (((a)>(b))?(a):(b))
+#define min(a,b) ((a>b)?(b):(a))
+
+// positions a pass can cover: repetitions may hang off either end of the
+// centroid by almost their whole length
+#define AVERAGE_SPAN (3*MAX_REF_SIZE)
+
+// Aligns each repetition to the centroid c with align() and averages the
+// positions more than half of them reach into c. Returns the new size.
+static int shift_pass(DataVec reps[][MAX_REF_SIZE], const int *sizes, int n, DataVec *c, int size) {
+  static int32_t sum[AVERAGE_SPAN][3];
+  static uint8_t support[AVERAGE_SPAN];
+  int delay[GESTURE_REPS];
+  int lo = 0, hi = 0, first, last, i, j, k, p;
+
+  for (k = 0; k < n; k++) { // reps[k][j] lines up with c[j+delay[k]]
+    delay[k] = align(c, size, reps[k], sizes[k]);
+    lo = k == 0 ? delay[k] : min(lo, delay[k]);
+    hi = k == 0 ? delay[k]+sizes[k] : max(hi, delay[k]+sizes[k]);
+  }
+  memset(sum, 0, sizeof(sum));
+  memset(support, 0, sizeof(support));
+  for (k = 0; k < n; k++) {
+    for (j = 0; j < sizes[k]; j++) {
+      p = j+delay[k]-lo;
+      sum[p][0] += reps[k][j].x;
+      sum[p][1] += reps[k][j].y;
+      sum[p][2] += reps[k][j].z;
+      support[p]++;
+    }
+  }
+  // any position between two reached by a majority is reached by a
+  // repetition covering both
+  first = 0;
+  while (first < hi-lo && support[first]*2 <= n) {
+    first++;
+  }
+  last = hi-lo;
+  while (last > first && support[last-1]*2 <= n) {
+    last--;
+  }
+  size = min(last-first, MAX_REF_SIZE);
+  for (i = 0; i < size; i++) {
+    p = first+i;
+    c[i].x = sum[p][0]/support[p];
+    c[i].y = sum[p][1]/support[p];
+    c[i].z = sum[p][2]/support[p];
+  }
+  return size;
+}
+
+#if AVERAGE_DBA
+// Moves each centroid sample to the mean of the repetition samples the DTW
+// paths pair it with. Returns false once nothing moves.
+static bool dba_pass(DataVec reps[][MAX_REF_SIZE], const int *sizes, int n, DataVec *c, int size) {
+  static int32_t sum[MAX_REF_SIZE][3];
+  static uint8_t count[MAX_REF_SIZE];
+  static uint8_t path1[2*MAX_REF_SIZE], path2[2*MAX_REF_SIZE];
+  Span centroid = { .ring = c, .cap = size, .start = 0, .size = size };
+  DataVec v;
+  int i, k, m, len;
+  bool moved = false;
+
+  memset(sum, 0, sizeof(sum));
+  memset(count, 0, sizeof(count));
+  for (k = 0; k < n; k++) {
+    len = dtw_path(&centroid, reps[k], sizes[k], path1, path2);
+    for (m = 0; m < len; m++) {
+      sum[path1[m]][0] += reps[k][path2[m]].x;
+      sum[path1[m]][1] += reps[k][path2[m]].y;
+      sum[path1[m]][2] += reps[k][path2[m]].z;
+      count[path1[m]]++;
+    }
+  }
+  for (i = 0; i < size; i++) {
+    if (count[i] == 0) {
+      continue;
+    }
+    v.x = sum[i][0]/count[i];
+    v.y = sum[i][1]/count[i];
+    v.z = sum[i][2]/count[i];
+    moved = moved || v.x != c[i].x || v.y != c[i].y || v.z != c[i].z;
+    c[i] = v;
+  }
+  return moved;
+}
+#endif
+
+int average_reps(DataVec reps[][MAX_REF_SIZE], const int *sizes, int n, DataVec *out) {
+  DataVec prev[MAX_REF_SIZE];
+  int size, prev_size, it;
+
+  n = min(n, GESTURE_REPS);
+  if (n <= 0) {
+    return 0;
+  }
+  size = sizes[0];
+  memcpy(out, reps[0], sizeof(DataVec)*size);
+  for (it = 0; it < AVERAGE_ITERATIONS; it++) {
+    prev_size = size;
+    memcpy(prev, out, sizeof(DataVec)*size);
+    size = shift_pass(reps, sizes, n, out, size);
+    APP_LOG(APP_LOG_LEVEL_INFO, "shift pass %d: size %d", it, size);
+    if (size == prev_size && !memcmp(prev, out, sizeof(DataVec)*size)) {
+      break;
+    }
+  }
+#if AVERAGE_DBA
+  for (it = 0; it < AVERAGE_ITERATIONS && dba_pass(reps, sizes, n, out, size); it++) {
+  }
+#endif
+  return size;
+}
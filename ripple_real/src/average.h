@@ -0,0 +1,26 @@
+/*
+ * average.h
+ * Builds a template from several training repetitions of a gesture.
+ */
+
+#pragma once
+
+#include "gesture.h"
+
+// passes refining the centroid; each kind stops early once it settles
+#ifndef AVERAGE_ITERATIONS
+#define AVERAGE_ITERATIONS 3
+#endif
+
+// Follows the shift average with DTW barycenter averaging, which lines
+// repetitions up sample by sample even when they were made at different
+// speeds. On by default with the DTW matcher, whose distance it minimises.
+#ifndef AVERAGE_DBA
+#define AVERAGE_DBA (GESTURE_MATCHER == GESTURE_MATCHER_DTW)
+#endif
+
+// Averages n (at most GESTURE_REPS) repetitions into out and returns its
+// size. The first repetition seeds the centroid; each pass aligns every
+// repetition to it and averages them again. Samples that no more than half
+// the repetitions reach are trimmed from both ends.
+int average_reps(DataVec reps[][MAX_REF_SIZE], const int *sizes, int n, DataVec *out);
@@ -0,0 +1,66 @@
+/*
+ * classify.c
+ * Linear classifier, a score per gesture.
+ */
+
+#include "classify.h"
+
+static int32_t bias[MAX_GESTURES];
+static int8_t weight[MAX_GESTURES][FEATURE_COUNT];
+static int classes;
+
+void classify_reset() {
+  classes = 0;
+}
+
+int classify_classes() {
+  return classes;
+}
+
+bool classify_unpack(const uint8_t *buf, int len) {
+  const uint8_t *p = &buf[2];
+  int c;
+
+  if (len < 2 || buf[0] > MAX_GESTURES || buf[1] != FEATURE_COUNT || len < 2 + buf[0]*CLASSIFY_CLASS_SIZE) {
+    return false;
+  }
+  classes = buf[0];
+  for (c = 0; c < classes; c++, p += CLASSIFY_CLASS_SIZE) {
+    bias[c] = (int32_t)(p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+    memcpy(weight[c], &p[4], FEATURE_COUNT);
+  }
+  return true;
+}
+
+int classify_pack(uint8_t *buf) {
+  uint8_t *p = &buf[2];
+  int c;
+
+  buf[0] = classes;
+  buf[1] = FEATURE_COUNT;
+  for (c = 0; c < classes; c++, p += CLASSIFY_CLASS_SIZE) {
+    p[0] = bias[c] & 0xff;
+    p[1] = (bias[c] >> 8) & 0xff;
+    p[2] = (bias[c] >> 16) & 0xff;
+    p[3] = (uint32_t)bias[c] >> 24;
+    memcpy(&p[4], weight[c], FEATURE_COUNT);
+  }
+  return 2 + classes*CLASSIFY_CLASS_SIZE;
+}
+
+int classify(const int8_t *f, int32_t *score) {
+  int32_t s;
+  int best = 0, c, k;
+
+  for (c = 0; c < classes; c++) {
+    s = bias[c];
+    for (k = 0; k < FEATURE_COUNT; k++) {
+      s += weight[c][k]*f[k];
+    }
+    if (c == 0 || s > *score) {
+      *score = s;
+      best = c;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,38 @@
+/*
+ * classify.h
+ * Linear classifier over feature.h vectors, trained on the phone. Class c
+ * is gesture c; its score is
+ *
+ *   bias[c] + sum of weight[c][k]*f[k]
+ *
+ * and the motion is that of the best scoring class if its score is above
+ * zero. The trainer fits a score for the junk too and takes it from every
+ * class's, so zero is where a gesture beats the junk. The weights arrive
+ * in KEY_CLASSIFIER as
+ *
+ *   uint8 classes, uint8 FEATURE_COUNT
+ *   for each class: int32 bias, FEATURE_COUNT int8 weights
+ *
+ * little-endian, as host/train_linear.py writes them.
+ */
+
+#pragma once
+
+#include "gesture.h"
+#include "feature.h"
+
+#define CLASSIFY_CLASS_SIZE (4 + FEATURE_COUNT)
+#define CLASSIFY_PACKED_MAX (2 + MAX_GESTURES*CLASSIFY_CLASS_SIZE)
+
+void classify_reset();
+// classes the loaded weights cover, 0 if none are
+int classify_classes();
+
+// Loads packed weights. False, keeping the old ones, if they are malformed
+// or for other features.
+bool classify_unpack(const uint8_t *buf, int len);
+// packs the loaded weights into buf, CLASSIFY_PACKED_MAX bytes at most
+int classify_pack(uint8_t *buf);
+
+// returns the best scoring class for f and leaves its score in score
+int classify(const int8_t *f, int32_t *score);
@@ -0,0 +1,82 @@
+/*
+ * codec.c
+ * Delta + zigzag varint coding of x, y, z sample streams.
+ */
+
+#include "codec.h"
+
+// small changes of either sign to small unsigned numbers: 0, -1, 1, -2 ...
+static uint32_t zigzag(int32_t v) {
+  return v < 0 ? ((uint32_t)-v << 1) - 1 : (uint32_t)v << 1;
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (v & 1) ? -(int32_t)(v >> 1) - 1 : (int32_t)(v >> 1);
+}
+
+int codec_put_varint(uint8_t *buf, uint32_t v) {
+  int n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = v;
+  return n;
+}
+
+int codec_get_varint(const uint8_t *buf, int len, uint32_t *v) {
+  int n = 0, shift = 0;
+  *v = 0;
+  while (n < len && shift < 32) {
+    *v |= (uint32_t)(buf[n] & 0x7f) << shift;
+    if (!(buf[n++] & 0x80)) {
+      return n;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+int codec_encode(const DataVec *v, int n, uint8_t *buf, int max) {
+  uint8_t tmp[9];
+  int16_t px = 0, py = 0, pz = 0;
+  int i, k, used = 0;
+  for (i = 0; i < n; i++) {
+    k = codec_put_varint(tmp, zigzag(v[i].x - px));
+    k += codec_put_varint(&tmp[k], zigzag(v[i].y - py));
+    k += codec_put_varint(&tmp[k], zigzag(v[i].z - pz));
+    if (used+k > max) {
+      return 0;
+    }
+    memcpy(&buf[used], tmp, k);
+    used += k;
+    px = v[i].x;
+    py = v[i].y;
+    pz = v[i].z;
+  }
+  return used;
+}
+
+int codec_decode(const uint8_t *buf, int len, DataVec *v, int n) {
+  int16_t px = 0, py = 0, pz = 0;
+  uint32_t d;
+  int i, k, used = 0;
+  for (i = 0; i < n; i++) {
+    if (!(k = codec_get_varint(&buf[used], len-used, &d))) {
+      return 0;
+    }
+    used += k;
+    v[i].x = px += unzigzag(d);
+    if (!(k = codec_get_varint(&buf[used], len-used, &d))) {
+      return 0;
+    }
+    used += k;
+    v[i].y = py += unzigzag(d);
+    if (!(k = codec_get_varint(&buf[used], len-used, &d))) {
+      return 0;
+    }
+    used += k;
+    v[i].z = pz += unzigzag(d);
+  }
+  return used;
+}
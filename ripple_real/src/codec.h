@@ -0,0 +1,23 @@
+/*
+ * codec.h
+ * Compact wire coding of x, y, z sample streams. Each axis is sent as the
+ * zigzag varint of its change from the previous sample (from 0 for the
+ * first), so slow motion takes about a byte per axis instead of two.
+ */
+
+#pragma once
+
+#include "gesture.h"
+
+// worst case: every change needs 3 varint bytes
+#define CODEC_MAX_BYTES(n) ((n)*9)
+
+// little-endian base-128, 7 bits a byte, high bit set on all but the last
+int codec_put_varint(uint8_t *buf, uint32_t v);
+// returns the bytes read, or 0 if buf ends inside the varint
+int codec_get_varint(const uint8_t *buf, int len, uint32_t *v);
+
+// Returns the bytes written, or 0 if they would pass max.
+int codec_encode(const DataVec *v, int n, uint8_t *buf, int max);
+// Reads n samples. Returns the bytes read, or 0 if buf is too short.
+int codec_decode(const uint8_t *buf, int len, DataVec *v, int n);
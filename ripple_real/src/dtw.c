@@ -0,0 +1,195 @@
+/*
+ * dtw.c
+ * Banded dynamic time warping with two rolling rows of 16 bit costs.
+ */
+
+#include "dtw.h"
+
+#define DTW_WIDTH (2*GESTURE_DTW_BAND+1)
+#define DTW_INF UINT16_MAX
+
+// how the cheapest path entered a cell
+#define MOVE_DIAGONAL 0
+#define MOVE_UP 1 // from the previous ges1 sample
+#define MOVE_LEFT 2 // from the previous ges2 sample
+
+#define max(a,b) (((a)>(b))?(a):(b))
+#define min(a,b) ((a>b)?(b):(a))
+
+// squared error in cost units, saturated to 16 bits
+static uint16_t cell_cost(const DataVec *a, const DataVec *b) {
+  int32_t dx = a->x - b->x;
+  int32_t dy = a->y - b->y;
+  int32_t dz = a->z - b->z;
+  uint32_t err = ((uint32_t)(dx*dx) + (uint32_t)(dy*dy) + (uint32_t)(dz*dz)) >> DTW_COST_SHIFT;
+  return err < DTW_INF ? err : DTW_INF;
+}
+
+// first reference sample in the band of capture row i
+static int band_lo(int i, int size1, int size2) {
+  int centre = size1 > 1 ? (i*(size2-1) + (size1-1)/2)/(size1-1) : 0;
+  return centre - GESTURE_DTW_BAND;
+}
+
+// Row i of the cost matrix covers ges2[lo..lo+DTW_WIDTH) with lo following
+// the diagonal from (0, 0) to (size1-1, size2-1), so rows of different
+// length captures still meet at both corners. len holds the steps of the
+// path each cost came from. Returns the cost of the cheapest path and its
+// steps, and if from is given leaves in it the move into each cell.
+static uint32_t fill(Span *ges1, DataVec *ges2, int size2, uint8_t (*from)[DTW_WIDTH], uint8_t *path_len) {
+  static uint16_t cost[2][DTW_WIDTH];
+  static uint8_t len[2][DTW_WIDTH];
+  int size1 = ges1->size;
+  int i, j, k, lo, prev_lo = 0, cur = 0, prev, pk;
+  uint16_t best, c;
+  uint8_t steps, move;
+
+  for (i = 0; i < size1; i++) {
+    cur = i&1;
+    prev = cur^1;
+    lo = band_lo(i, size1, size2);
+    for (k = 0; k < DTW_WIDTH; k++) {
+      j = lo+k;
+      cost[cur][k] = DTW_INF;
+      len[cur][k] = 0;
+      if (j < 0 || j >= size2) {
+        continue;
+      }
+      if (i == 0 && j == 0) {
+        best = 0;
+        steps = 0;
+        move = MOVE_DIAGONAL;
+      } else {
+        best = DTW_INF;
+        steps = 0;
+        move = MOVE_DIAGONAL;
+        pk = j-prev_lo;
+        if (i > 0 && pk >= 1 && pk <= DTW_WIDTH && cost[prev][pk-1] < best) { // diagonal first
+          best = cost[prev][pk-1];
+          steps = len[prev][pk-1];
+        }
+        if (i > 0 && pk >= 0 && pk < DTW_WIDTH && cost[prev][pk] < best) {
+          best = cost[prev][pk];
+          steps = len[prev][pk];
+          move = MOVE_UP;
+        }
+        if (k > 0 && cost[cur][k-1] < best) {
+          best = cost[cur][k-1];
+          steps = len[cur][k-1];
+          move = MOVE_LEFT;
+        }
+        if (best == DTW_INF) { // outside the band of the previous row
+          continue;
+        }
+      }
+      c = cell_cost(span_at(ges1, i), &ges2[j]);
+      cost[cur][k] = (uint32_t)best+c < DTW_INF ? best+c : DTW_INF;
+      len[cur][k] = steps+1;
+      if (from) {
+        from[i][k] = move;
+      }
+    }
+    prev_lo = lo;
+  }
+
+  // the last row is centred on ges2[size2-1]
+  k = size2-1 - prev_lo;
+  if (k >= DTW_WIDTH || cost[cur][k] == DTW_INF) {
+    return DTW_INF;
+  }
+  *path_len = len[cur][k];
+  return cost[cur][k];
+}
+
+energy_t dtw_distance(Span *ges1, DataVec *ges2, int size2) {
+  uint32_t total;
+  uint8_t len;
+
+  if (ges1->size <= 0 || size2 <= 0) {
+    return (energy_t)((uint32_t)DTW_INF << DTW_COST_SHIFT);
+  }
+  total = fill(ges1, ges2, size2, NULL, &len);
+  if (total == DTW_INF) {
+    return (energy_t)(total << DTW_COST_SHIFT);
+  }
+  return (energy_t)((total << DTW_COST_SHIFT)/len);
+}
+
+int dtw_path(Span *ges1, DataVec *ges2, int size2, uint8_t *path1, uint8_t *path2) {
+  static uint8_t from[MAX_REF_SIZE][DTW_WIDTH];
+  int size1 = ges1->size;
+  int i, j, n;
+  uint8_t len;
+
+  if (size1 <= 0 || size2 <= 0 || size1 > MAX_REF_SIZE || fill(ges1, ges2, size2, from, &len) == DTW_INF) {
+    return 0;
+  }
+  // walk back from the last corner, filling the path from its end
+  i = size1-1;
+  j = size2-1;
+  for (n = len-1; n >= 0; n--) {
+    path1[n] = i;
+    path2[n] = j;
+    switch (from[i][j-band_lo(i, size1, size2)]) {
+    case MOVE_DIAGONAL:
+      i--;
+      j--;
+      break;
+    case MOVE_UP:
+      i--;
+      break;
+    case MOVE_LEFT:
+      j--;
+      break;
+    }
+  }
+  return len;
+}
+
+void dtw_envelope(DataVec *ref, int size, DataVec *upper, DataVec *lower) {
+  int j, k;
+  for (j = 0; j < size; j++) {
+    upper[j] = lower[j] = ref[j];
+    for (k = max(0,j-GESTURE_DTW_BAND); k <= min(size-1,j+GESTURE_DTW_BAND); k++) {
+      upper[j].x = max(upper[j].x, ref[k].x);
+      upper[j].y = max(upper[j].y, ref[k].y);
+      upper[j].z = max(upper[j].z, ref[k].z);
+      lower[j].x = min(lower[j].x, ref[k].x);
+      lower[j].y = min(lower[j].y, ref[k].y);
+      lower[j].z = min(lower[j].z, ref[k].z);
+    }
+  }
+}
+
+// distance from v to the nearest point in [lo, hi]
+static int32_t outside(int16_t v, int16_t lo, int16_t hi) {
+  return v > hi ? v-hi : (v < lo ? lo-v : 0);
+}
+
+// Every row of the path has a cell in the band, and the envelope at the
+// centre of row i spans the whole band, so each row costs at least the
+// squared distance from its capture sample to that box. Paths are at most
+// size1+size2-1 cells long, which bounds the mean.
+energy_t dtw_lower_bound(Span *ges1, DataVec *upper, DataVec *lower, int size2) {
+  int size1 = ges1->size;
+  int i, c;
+  int32_t dx, dy, dz;
+  uint32_t total = 0;
+  DataVec *v;
+
+  if (size1 <= 0 || size2 <= 0) {
+    return (energy_t)((uint32_t)DTW_INF << DTW_COST_SHIFT);
+  }
+  for (i = 0; i < size1 && total < DTW_INF; i++) {
+    c = band_lo(i, size1, size2) + GESTURE_DTW_BAND;
+    v = span_at(ges1, i);
+    dx = outside(v->x, lower[c].x, upper[c].x);
+    dy = outside(v->y, lower[c].y, upper[c].y);
+    dz = outside(v->z, lower[c].z, upper[c].z);
+    total += ((uint32_t)(dx*dx) + (uint32_t)(dy*dy) + (uint32_t)(dz*dz)) >> DTW_COST_SHIFT;
+  }
+  if (total >= DTW_INF) {
+    return (energy_t)((uint32_t)DTW_INF << DTW_COST_SHIFT);
+  }
+  return (energy_t)((total << DTW_COST_SHIFT)/(size1+size2-1));
+}
@@ -0,0 +1,36 @@
+/*
+ * dtw.h
+ * Dynamic time warping distance between a captured motion and a reference,
+ * constrained to a Sakoe-Chiba band around the diagonal.
+ */
+
+#pragma once
+
+#include "align.h"
+
+// cells of the warping path may stray this many reference samples from the
+// diagonal, about 20% of a full-length reference by default
+#ifndef GESTURE_DTW_BAND
+#define GESTURE_DTW_BAND 6
+#endif
+
+// Path costs are kept in 16 bits, in units of 1 << DTW_COST_SHIFT squared
+// mG, and saturate. A saturated path averages over 3e6 per step, well past
+// sum_thresh, so saturation can only turn a miss into a miss.
+#define DTW_COST_SHIFT 12
+
+// mean squared error per step along the cheapest path from (0, 0) to the
+// last samples of both, in the same units as the shift-and-SSE score
+energy_t dtw_distance(Span *ges1, DataVec *ges2, int size2);
+
+// Leaves the cheapest path's cells in path1[n], path2[n] (indices into ges1
+// and ges2), which need room for size1+size2-1, and returns its length, or
+// 0 if there is none. ges1 may be at most MAX_REF_SIZE long.
+int dtw_path(Span *ges1, DataVec *ges2, int size2, uint8_t *path1, uint8_t *path2);
+
+// per-axis maximum and minimum of ref within GESTURE_DTW_BAND of each sample
+void dtw_envelope(DataVec *ref, int size, DataVec *upper, DataVec *lower);
+
+// LB_Keogh bound on dtw_distance() from the envelope of ges2: never more
+// than the distance, for a fraction of the work
+energy_t dtw_lower_bound(Span *ges1, DataVec *upper, DataVec *lower, int size2);
@@ -0,0 +1,61 @@
+/*
+ * feature.c
+ * Feature extraction for the linear classifier.
+ */
+
+#include "feature.h"
+
+static int8_t clamp8(int32_t v) {
+  return v > INT8_MAX ? INT8_MAX : (v < INT8_MIN ? INT8_MIN : v);
+}
+
+// sum/n in steps of 1 << STORE_SHIFT, rounded half away from zero
+static int8_t scaled_mean(int32_t sum, int n) {
+  int32_t d = n << STORE_SHIFT;
+  return clamp8(sum >= 0 ? (sum + d/2)/d : (sum - d/2)/d);
+}
+
+// counts the sign changes of an axis, ignoring wobbles inside the deadband
+static void cross(int16_t v, int8_t *sign, int8_t *count) {
+  int8_t s = v > FEATURE_DEADBAND ? 1 : (v < -FEATURE_DEADBAND ? -1 : 0);
+  if (s == 0) {
+    return;
+  }
+  if (*sign != 0 && s != *sign && *count < INT8_MAX) {
+    (*count)++;
+  }
+  *sign = s;
+}
+
+void features_extract(Span *ges, int8_t *f) {
+  int32_t sum[3], mag[3] = { 0, 0, 0 };
+  int8_t sign[3] = { 0, 0, 0 }, count[3] = { 0, 0, 0 };
+  int n = ges->size, s, j, from, to;
+  DataVec *v;
+
+  for (s = 0; s < FEATURE_SEGMENTS; s++) {
+    from = s*n/FEATURE_SEGMENTS;
+    to = (s+1)*n/FEATURE_SEGMENTS;
+    sum[0] = sum[1] = sum[2] = 0;
+    for (j = from; j < to; j++) {
+      v = span_at(ges, j);
+      sum[0] += v->x;
+      sum[1] += v->y;
+      sum[2] += v->z;
+      mag[0] += abs(v->x);
+      mag[1] += abs(v->y);
+      mag[2] += abs(v->z);
+      cross(v->x, &sign[0], &count[0]);
+      cross(v->y, &sign[1], &count[1]);
+      cross(v->z, &sign[2], &count[2]);
+    }
+    for (j = 0; j < 3; j++) {
+      f[FEATURE_SHAPE + 3*s + j] = to > from ? scaled_mean(sum[j], to-from) : 0;
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    f[FEATURE_MAGNITUDE + j] = n > 0 ? scaled_mean(mag[j], n) : 0;
+    f[FEATURE_CROSSINGS + j] = count[j];
+  }
+  f[FEATURE_LENGTH] = clamp8(n);
+}
@@ -0,0 +1,25 @@
+/*
+ * feature.h
+ * Fixed-length summary of a motion for the linear classifier: per-axis
+ * means over FEATURE_SEGMENTS equal stretches of it, per-axis mean
+ * magnitude and zero crossings, and its length. Means and magnitudes are
+ * in steps of 1 << STORE_SHIFT mG, like stored templates, so every
+ * feature fits an int8. host/train_linear.py computes the same features
+ * and must change with them.
+ */
+
+#pragma once
+
+#include "align.h"
+
+#define FEATURE_SEGMENTS 4
+// a zero crossing only counts once the axis has been this far past zero
+#define FEATURE_DEADBAND 64 // mG
+
+#define FEATURE_SHAPE 0 // 3*FEATURE_SEGMENTS segment means, x, y, z each
+#define FEATURE_MAGNITUDE (FEATURE_SHAPE + 3*FEATURE_SEGMENTS) // x, y, z
+#define FEATURE_CROSSINGS (FEATURE_MAGNITUDE + 3) // x, y, z
+#define FEATURE_LENGTH (FEATURE_CROSSINGS + 3)
+#define FEATURE_COUNT (FEATURE_LENGTH + 1)
+
+void features_extract(Span *ges, int8_t *f);
@@ -0,0 +1,862 @@
+/*
+ * gesture.c
+ * Gesture recognition engine. Filters accelerometer samples with a moving
+ * average, segments motion between periods of stillness, and either records
+ * training repetitions or matches the motion against stored gestures.
+ * Filtering and scoring run in integers unless GESTURE_FIXED_POINT is 0.
+ */
+
+#include "gesture.h"
+#include "align.h"
+#include "dtw.h"
+#include "store.h"
+#include "profile.h"
+#include "average.h"
+#include "classify.h"
+#include "shortlist.h"
+
+#define max(a,b) (((a)>(b))?(a):(b))
+#define min(a,b) ((a>b)?(b):(a))
+#define abs(a) (((a)>0)?(a):(-(a)))
+
+// ring of the latest samples. capture is the span of it holding the motion
+// being segmented; once its post-roll is in, the ring is frozen until the
+// capture has been used.
+static DataVec accel_buff[MAX_BUFF_SIZE];
+static int head; // head of buffer, where the next sample goes
+static int history; // samples in the ring
+static Span capture;
+static int post_left; // post-roll samples still to come
+static bool frozen;
+#if GESTURE_MATCHER == GESTURE_MATCHER_STREAM
+static AlignStream streams[GESTURE_STREAMS]; // running alignment of the capture to the first gestures
+#endif
+static bool streamed; // the streams hold the whole capture
+static int start_proc; // begin processing
+static int make_gesture;
+static int session; // make_gesture lasts until all repetitions are in
+static int min_ges_i;
+static energy_t min_ges; // score of min_ges_i, after match() against its limit
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+static int min_delay; // shift of min_ges_i against the capture
+#endif
+static int adapted;
+static energy_t still;
+static int show_still;
+static const energy_t still_floor = 100000;
+static const energy_t sum_base = 1000000;
+static energy_t still_thresh;
+static energy_t sum_thresh;
+static const int count_thresh = 4;
+static const energy_t limit_floor = 750000;
+
+// Noise estimate: a running median of the residual energy between
+// captures, which the gestures themselves cannot drag up. Each sample moves
+// it a 1/rate step towards itself, rate growing to 1 << NOISE_SHIFT over
+// the first samples after calibration. NOISE_LOUD_RUN samples in a row
+// without stillness, captured or not, are no gesture, so past them the
+// samples count too, and the thresholds climb until a vibrating bus or a
+// walk reads as rest.
+#define NOISE_SHIFT 6
+#define NOISE_K 2
+#define NOISE_SUM_K 2
+#define NOISE_LOUD_RUN (4*MAX_BUFF_SIZE)
+static energy_t noise_med;
+static int noise_n;
+static int loud_run;
+
+#define Q16(v) ((int32_t)(v)*65536)
+
+#if GESTURE_KALMAN
+// Gravity estimate per axis in Q16 mG, and its variance in squared mG,
+// which is the same for all three axes as they share the noise model
+static int32_t x_grav;
+static int32_t y_grav;
+static int32_t z_grav;
+static int32_t grav_var;
+static DataVec last; // the previous sample, for the jerk
+
+static void filter_reset(AccelData *accel) {
+  x_grav = Q16(accel->x);
+  y_grav = Q16(accel->y);
+  z_grav = Q16(accel->z);
+  grav_var = KALMAN_R;
+  last.x = accel->x;
+  last.y = accel->y;
+  last.z = accel->z;
+}
+
+// moves the estimate gain (Q16) of the way to v and returns the rest of v,
+// rounded to whole mG
+static int16_t linear(int32_t *grav, int16_t v, int32_t gain) {
+  int32_t diff = Q16(v) - *grav;
+  *grav += (int32_t)(((int64_t)diff*gain + (1 << 15)) >> 16);
+  diff = Q16(v) - *grav;
+  return (diff + (1 << 15)) >> 16;
+}
+
+// One step of a scalar Kalman filter per axis, with gravity as a random
+// walk of KALMAN_Q squared mG a sample. The measurement noise is
+// KALMAN_R plus the squared jerk, so while the wrist is held still, even
+// at a new angle, the estimate settles in a few samples, and while it
+// moves the estimate holds and the motion passes through whole. Leaves
+// the linear acceleration in v and returns its energy.
+static energy_t filter(AccelData *accel, DataVec *v) {
+  int32_t dx = accel->x - last.x;
+  int32_t dy = accel->y - last.y;
+  int32_t dz = accel->z - last.z;
+  int32_t noise = KALMAN_R + min(dx*dx + dy*dy + dz*dz, KALMAN_JERK_MAX);
+  int32_t gain = ((int64_t)grav_var << 16)/(grav_var + noise);
+
+  grav_var = (int32_t)(((int64_t)grav_var*(65536 - gain)) >> 16) + KALMAN_Q;
+  v->x = linear(&x_grav, accel->x, gain);
+  v->y = linear(&y_grav, accel->y, gain);
+  v->z = linear(&z_grav, accel->z, gain);
+  last.x = accel->x;
+  last.y = accel->y;
+  last.z = accel->z;
+  return (int32_t)v->x*v->x + (int32_t)v->y*v->y + (int32_t)v->z*v->z;
+}
+#endif
+
+#if GESTURE_FIXED_POINT
+#if !GESTURE_KALMAN
+// moving averages in Q16, alpha = 0.1
+#define ALPHA_Q16 6554
+static int32_t x_mavg;
+static int32_t y_mavg;
+static int32_t z_mavg;
+
+static void filter_reset(AccelData *accel) {
+  x_mavg = Q16(accel->x);
+  y_mavg = Q16(accel->y);
+  z_mavg = Q16(accel->z);
+}
+
+// Q16 residual rounded to whole mG
+static int32_t residual(int32_t *mavg, int16_t v) {
+  int32_t diff = Q16(v) - *mavg;
+  *mavg += (int32_t)(((int64_t)diff*ALPHA_Q16 + (1 << 15)) >> 16);
+  diff = Q16(v) - *mavg;
+  return (diff + (1 << 15)) >> 16;
+}
+
+// Rounding each residual to a whole mG, with ALPHA_Q16 a hair over 0.1,
+// keeps it within 1 mG of the float one, so still stays within
+// 2(|x_diff| + |y_diff| + |z_diff|) + 3 of the float value, about 1% of
+// still_thresh at the threshold. The samples go on as they came.
+static energy_t filter(AccelData *accel, DataVec *v) {
+  int32_t x_diff = residual(&x_mavg, accel->x);
+  int32_t y_diff = residual(&y_mavg, accel->y);
+  int32_t z_diff = residual(&z_mavg, accel->z);
+  v->x = accel->x;
+  v->y = accel->y;
+  v->z = accel->z;
+  return x_diff*x_diff + y_diff*y_diff + z_diff*z_diff;
+}
+#endif
+
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+// exact in integers: |diff| <= 8000 mG keeps each term in 32 bits
+static energy_t sq_err(DataVec *a, DataVec *b) {
+  int32_t dx = a->x - b->x;
+  int32_t dy = a->y - b->y;
+  int32_t dz = a->z - b->z;
+  return dx*dx + dy*dy + dz*dz;
+}
+#endif
+#else
+#if !GESTURE_KALMAN
+static const float alpha = 0.1;
+static float x_mavg;
+static float y_mavg;
+static float z_mavg;
+
+static void filter_reset(AccelData *accel) {
+  x_mavg = accel->x;
+  y_mavg = accel->y;
+  z_mavg = accel->z;
+}
+
+static energy_t filter(AccelData *accel, DataVec *v) {
+  float x_diff, y_diff, z_diff;
+  x_mavg = x_mavg + alpha*((float)accel->x - x_mavg);
+  y_mavg = y_mavg + alpha*((float)accel->y - y_mavg);
+  z_mavg = z_mavg + alpha*((float)accel->z - z_mavg);
+  x_diff = (float)accel->x - x_mavg;
+  y_diff = (float)accel->y - y_mavg;
+  z_diff = (float)accel->z - z_mavg;
+  v->x = accel->x;
+  v->y = accel->y;
+  v->z = accel->z;
+  return x_diff*x_diff + y_diff*y_diff + z_diff*z_diff;
+}
+#endif
+
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+static energy_t sq_err(DataVec *a, DataVec *b) {
+  return (((float)(a->x - b->x))*((float)(a->x - b->x))) + (((float)(a->y - b->y))*((float)(a->y - b->y))) + (((float)(a->z - b->z))*((float)(a->z - b->z)));
+}
+#endif
+#endif
+
+// array of recorded gestures
+static DataVec temp_ges[GESTURE_REPS][MAX_REF_SIZE];
+static int temp_ges_size[GESTURE_REPS];
+static int temp_count;
+static int last_rep = -1;
+//static int gesture_ids[MAX_GESTURES];
+
+#if GESTURE_NOISE_TRACK
+// Updates the noise estimate with the latest sample and sets the
+// thresholds from it. A sample is quiet only while stillness is in and no
+// motion has started; one in a motion, or while waiting for the stillness
+// that begins listening, is loud and only counts once NOISE_LOUD_RUN loud
+// samples have gone by in a row.
+static void noise_update(bool quiet) {
+  int rate;
+  if (quiet) {
+    loud_run = 0;
+  } else if (loud_run < NOISE_LOUD_RUN) {
+    loud_run++;
+    return;
+  }
+  rate = noise_n < (1 << NOISE_SHIFT) ? ++noise_n : (1 << NOISE_SHIFT);
+  if (rate == 1) {
+    noise_med = still;
+  } else if (still > noise_med) {
+    noise_med += min(still - noise_med, noise_med/rate + 1);
+  } else {
+    noise_med -= min(noise_med - still, noise_med/rate);
+  }
+  still_thresh = max(still_floor, NOISE_K*noise_med);
+  sum_thresh = sum_base + NOISE_SUM_K*noise_med;
+}
+#endif
+
+void gesture_init() {
+  head = 0; // begin head at beginning of buffer
+  history = 0;
+  capture = (Span) { .ring = accel_buff, .cap = MAX_BUFF_SIZE, .start = 0, .size = 0 };
+  post_left = 0;
+  frozen = false;
+  streamed = false;
+  start_proc = 0;
+  make_gesture = 0;
+  session = 0;
+  adapted = -1;
+  still_thresh = still_floor;
+  sum_thresh = sum_base;
+  noise_med = 0;
+  noise_n = 0;
+  loud_run = 0;
+  store_init();
+  shortlist_reset();
+  classify_reset();
+  temp_count = 0;
+}
+
+void gesture_make() {
+  make_gesture = 1;
+}
+
+void gesture_make_session() {
+  make_gesture = 1;
+  session = 1;
+}
+
+int gesture_last_rep(DataVec *data) {
+  int i;
+  if (last_rep < 0) {
+    return 0;
+  }
+  for (i = 0; i < temp_ges_size[last_rep]; i++) {
+    data[i] = temp_ges[last_rep][i];
+  }
+  return temp_ges_size[last_rep];
+}
+
+bool gesture_started() {
+  return start_proc;
+}
+
+int gesture_stillness() {
+  return (int)still;
+}
+
+bool gesture_is_still() {
+  return show_still;
+}
+
+int gesture_still_thresh() {
+  return (int)still_thresh;
+}
+
+void gesture_calibrate() {
+  noise_n = 0;
+  loud_run = 0;
+}
+
+int gesture_found() {
+  return min_ges_i;
+}
+
+int gesture_adapted() {
+  return adapted;
+}
+
+int gesture_count() {
+  return store_count();
+}
+
+int gesture_get(int i, DataVec *data) {
+  return store_get(i, 0, data);
+}
+
+int gesture_limit(int i) {
+  return store_limit(i);
+}
+
+// stores a gesture with whatever matching needs alongside it, as a new
+// record, or over record i if i >= 0
+static bool gesture_store(DataVec *data, int size, int i) {
+  Span tmpl = { .ring = data, .cap = size, .start = 0, .size = size };
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+  // the envelopes of the rounded samples are the rounded envelopes
+  DataVec upper[MAX_REF_SIZE], lower[MAX_REF_SIZE];
+  DataVec *planes[3] = { data, upper, lower };
+  if (size > MAX_REF_SIZE) {
+    return false;
+  }
+  dtw_envelope(data, size, upper, lower);
+#else
+  DataVec *planes[1] = { data };
+#endif
+  if (i >= 0) {
+    store_set(i, planes, GESTURE_STORE_PLANES);
+    shortlist_set(i, &tmpl);
+    return true;
+  }
+  if (!store_add(planes, GESTURE_STORE_PLANES, size)) {
+    return false;
+  }
+  shortlist_set(store_count()-1, &tmpl);
+  return true;
+}
+
+bool gesture_add(DataVec *data, int size, int limit) {
+  if (size <= 0 || size > MAX_REF_SIZE || !gesture_store(data, size, -1)) {
+    return false;
+  }
+  store_set_limit(store_count()-1, limit);
+  streamed = false; // no stream for it until the next capture
+  return true;
+}
+
+// runs capture samples from index from onwards through the streams
+static void capture_feed(int from) {
+#if GESTURE_MATCHER == GESTURE_MATCHER_STREAM
+  const PackedVec *ref;
+  int n = min(store_count(), GESTURE_STREAMS);
+  int i, j;
+  PROFILE_START(t);
+  for (i = 0; i < n; i++) {
+    ref = store_packed(i, 0);
+    if (from == 0) {
+      align_stream_reset(&streams[i], store_size(i));
+    }
+    for (j = from; j < capture.size; j++) {
+      align_stream_push(&streams[i], span_at(&capture, j), ref);
+    }
+  }
+  if (from == 0) {
+    streamed = true;
+  }
+  PROFILE_END(PROFILE_ALIGN, t);
+#else
+  (void)from;
+#endif
+}
+
+static void ring_push(DataVec *v) {
+  if (frozen) {
+    return;
+  }
+  accel_buff[head] = *v;
+  head = (head+1)%(MAX_BUFF_SIZE);
+  history = min(history+1, MAX_BUFF_SIZE);
+  if (post_left > 0) {
+    capture.size++;
+    capture_feed(capture.size-1);
+    frozen = --post_left == 0;
+  }
+}
+
+// adds the newest sample to the capture. The first motion sample opens it
+// with up to GESTURE_PRE_ROLL samples of history; a motion too long for the
+// ring keeps its latest samples and leaves room for the post-roll.
+static void capture_motion(bool first) {
+  if (first) {
+    capture.size = min(GESTURE_PRE_ROLL+1, history);
+    capture.start = (head-capture.size+MAX_BUFF_SIZE)%MAX_BUFF_SIZE;
+    capture_feed(0);
+  } else if (capture.size < MAX_BUFF_SIZE-GESTURE_POST_ROLL) {
+    capture.size++;
+    capture_feed(capture.size-1);
+  } else {
+    capture.start = (capture.start+1)%MAX_BUFF_SIZE;
+    streamed = false; // the streams still count the dropped sample
+  }
+}
+
+// closes the capture on the sample after the motion, which is the first
+// of the post-roll
+static void capture_end() {
+  post_left = GESTURE_POST_ROLL;
+  if (post_left > 0) {
+    capture.size++;
+    capture_feed(capture.size-1);
+    post_left--;
+  }
+  frozen = post_left == 0;
+}
+
+// lets the ring run again once the capture has been used
+static void capture_release() {
+  post_left = 0;
+  frozen = false;
+}
+
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+// mean squared error between ges and ref where ges[j] lines up with
+// ref[j-delay]. False if they do not overlap.
+static bool span_error(Span *ges, DataVec *ref, int size, int delay, energy_t *avg) {
+  int n = min(ges->size,size+delay) - max(0,delay);
+  energy_sum_t sum = 0;
+  int j;
+  if (n <= 0) {
+    return false;
+  }
+  for (j = max(0,delay); j < min(ges->size,size+delay); j++) {
+    sum += sq_err(&ref[j-delay], span_at(ges, j));
+  }
+  *avg = sum/n;
+  return true;
+}
+#endif
+
+// Scores every training repetition against gesture i as matching would
+// and returns the gesture's limit: GESTURE_LIMIT_K times the worst score,
+// but no less than limit_floor, as a few close repetitions say little
+// about how far the next one may stray.
+static int training_limit(int i) {
+  DataVec ref[MAX_REF_SIZE];
+  int size = store_get(i, 0, ref);
+  energy_t err, worst = limit_floor/GESTURE_LIMIT_K;
+  Span rep;
+  int k;
+
+  for (k = 0; k < temp_count; k++) {
+    rep = (Span){ .ring = temp_ges[k], .cap = temp_ges_size[k], .start = 0, .size = temp_ges_size[k] };
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+    err = dtw_distance(&rep, ref, size);
+#else
+    if (!span_error(&rep, ref, size, align_span(&rep, ref, size), &err)) {
+      err = sum_base;
+    }
+#endif
+    worst = max(worst, err);
+  }
+  return min((energy_sum_t)GESTURE_LIMIT_K*worst/(1 << GESTURE_LIMIT_SHIFT), GESTURE_LIMIT_MAX);
+}
+
+// averages the training repetitions into a new stored gesture
+static bool make_template() {
+  DataVec ges[MAX_REF_SIZE];
+  int size;
+
+  APP_LOG(APP_LOG_LEVEL_INFO, "Aligning and Averaging");
+  size = average_reps(temp_ges, temp_ges_size, temp_count, ges);
+  if (!gesture_store(ges, size, -1)) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "No room to store a gesture of size %d", size);
+    temp_count = 0;
+    return false;
+  }
+  store_set_limit(store_count()-1, training_limit(store_count()-1));
+  temp_count = 0;
+  APP_LOG(APP_LOG_LEVEL_INFO, "Made gesture of size %d for id %d, limit %d", size, store_count()-1, store_limit(store_count()-1));
+  return true;
+}
+
+// Puts score e against gesture i on the scale of sum_thresh: a score at
+// the gesture's limit, plus what the noise at rest adds to sum_thresh,
+// comes out at sum_thresh.
+static energy_t normalize(energy_t e, int i) {
+#if GESTURE_TEMPLATE_LIMIT
+  int limit = store_limit(i);
+  if (limit > 0) {
+    return (energy_sum_t)e*sum_thresh/((energy_sum_t)limit*(1 << GESTURE_LIMIT_SHIFT) + (sum_thresh - sum_base));
+  }
+#else
+  (void)i;
+#endif
+  return e;
+}
+
+#if GESTURE_MATCHER != GESTURE_MATCHER_DTW
+// mean squared error between the capture and gesture i at the shift that
+// best aligns them. False if they do not overlap at that shift.
+static bool shift_error(int i, energy_t *avg, int *shift) {
+  DataVec ref[MAX_REF_SIZE];
+  int size = store_get(i, 0, ref);
+  int delay; // correlation during regular listening
+  bool overlap;
+  PROFILE_START(t);
+
+#if GESTURE_MATCHER == GESTURE_MATCHER_STREAM
+  delay = streamed && i < GESTURE_STREAMS ? align_stream_delay(&streams[i]) : align_span(&capture, ref, size);
+#else
+  delay = align_span(&capture, ref, size);
+#endif
+  PROFILE_END(PROFILE_ALIGN, t);
+  APP_LOG(APP_LOG_LEVEL_INFO, "delay is: %d", delay);
+  PROFILE_START(u);
+  overlap = span_error(&capture, ref, size, delay, avg);
+  *shift = delay;
+  PROFILE_END(PROFILE_SCORE, u);
+  return overlap;
+}
+#endif
+
+// leaves in order the templates worth aligning the capture against and
+// returns how many
+static int candidates(int *order) {
+  int count = store_count(), i;
+  if (GESTURE_CANDIDATES > 0 && count > GESTURE_CANDIDATES) {
+    return shortlist_find(&capture, count, GESTURE_CANDIDATES, order);
+  }
+  for (i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  return count;
+}
+
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+// Scores the captured motion against the shortlisted gestures. Returns true
+// if the closest one is within its limit and leaves its index in min_ges_i.
+// Gestures are tried in order of their envelope bound, and once the bound
+// passes the best distance so far the rest cannot win. As with the other
+// matchers the nearest is picked on the raw distance and only then held
+// to its limit.
+static bool match() {
+  energy_t bound[MAX_GESTURES];
+  int order[MAX_GESTURES], cand[MAX_GESTURES];
+  DataVec ref[MAX_REF_SIZE], upper[MAX_REF_SIZE], lower[MAX_REF_SIZE];
+  energy_t avg;
+  int count;
+  int i, k, n, size;
+  bool scored = false;
+  PROFILE_START(t);
+
+  min_ges_i = 0;
+  min_ges = 0;
+  count = candidates(cand);
+  for (n = 0; n < count; n++) { // insertion sort by bound
+    i = cand[n];
+    store_get(i, 1, upper);
+    size = store_get(i, 2, lower);
+    bound[i] = dtw_lower_bound(&capture, upper, lower, size);
+    for (k = n; k > 0 && bound[order[k-1]] > bound[i]; k--) {
+      order[k] = order[k-1];
+    }
+    order[k] = i;
+  }
+  PROFILE_END(PROFILE_ALIGN, t);
+  for (k = 0; k < count; k++) {
+    i = order[k];
+    if (scored && bound[i] > min_ges) {
+      APP_LOG(APP_LOG_LEVEL_INFO, "pruned %d gestures", count-k);
+      break;
+    }
+    APP_LOG(APP_LOG_LEVEL_INFO, "evaluating gesture num: %d", i);
+    size = store_get(i, 0, ref);
+    PROFILE_START(u);
+    avg = dtw_distance(&capture, ref, size);
+    PROFILE_END(PROFILE_SCORE, u);
+    if (!scored || avg < min_ges || (avg == min_ges && i < min_ges_i)) {
+      min_ges = avg;
+      min_ges_i = i;
+      scored = true;
+    }
+  }
+#else
+// scores the captured motion against the shortlisted gestures. Returns true
+// if the closest one is within its limit and leaves its index in min_ges_i.
+static bool match() {
+  int cand[MAX_GESTURES];
+  energy_t avg;
+  int count, i, k, shift;
+  bool scored = false;
+
+  min_ges_i = 0;
+  min_ges = 0;
+  count = candidates(cand);
+  for (k = 0; k < count; k++) { // evaluate similarity of each gesture
+    i = cand[k];
+    APP_LOG(APP_LOG_LEVEL_INFO, "evaluating gesture num: %d", i);
+    if (!shift_error(i, &avg, &shift)) {
+      continue;
+    }
+    if (!scored || avg < min_ges || (avg == min_ges && i < min_ges_i)) {
+      min_ges = avg;
+      min_ges_i = i;
+      min_delay = shift;
+      scored = true;
+    }
+  }
+#endif
+  APP_LOG(APP_LOG_LEVEL_INFO, "minimum square error: %de3", (int)(min_ges/1000));
+  min_ges = normalize(min_ges, min_ges_i);
+  if (scored && min_ges < sum_thresh) {
+    // found gesture!
+    APP_LOG(APP_LOG_LEVEL_INFO, "found gesture %d", min_ges_i);
+    return true;
+  }
+  return false;
+}
+
+#if GESTURE_CLASSIFY
+// scores the capture against gesture i alone, as match() would, so that a
+// classified motion adapts its template like a matched one
+static void score_class(int i) {
+  energy_t avg;
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+  DataVec ref[MAX_REF_SIZE];
+  int size = store_get(i, 0, ref);
+  avg = dtw_distance(&capture, ref, size);
+#else
+  int shift;
+  if (!shift_error(i, &avg, &shift)) {
+    min_ges = sum_thresh;
+    return;
+  }
+  min_delay = shift;
+#endif
+  min_ges = normalize(avg, i);
+}
+#endif
+
+// Tells the captured motion with the phone's classifier when it covers
+// every stored gesture, and by matching templates otherwise.
+static bool recognize() {
+#if GESTURE_CLASSIFY
+  int8_t f[FEATURE_COUNT];
+  int32_t score;
+  if (classify_classes() > 0 && classify_classes() == store_count()) {
+    PROFILE_START(t);
+    features_extract(&capture, f);
+    min_ges_i = classify(f, &score);
+    PROFILE_END(PROFILE_SCORE, t);
+    APP_LOG(APP_LOG_LEVEL_INFO, "classified as %d, score %d", min_ges_i, (int)score);
+    score_class(min_ges_i);
+    return score > 0;
+  }
+#endif
+  return match();
+}
+
+#if GESTURE_ADAPT
+// moves v 1/(1 << GESTURE_ADAPT_RATE) of the way to target, rounding to nearest
+static int16_t blend(int16_t v, int32_t target) {
+  int32_t d = target - v;
+  return v + (d >= 0 ? d + (1 << GESTURE_ADAPT_RATE)/2 : d - (1 << GESTURE_ADAPT_RATE)/2)/(1 << GESTURE_ADAPT_RATE);
+}
+
+// Blends the capture into template min_ges_i where they line up: at the
+// matched shift, or for DTW along the warping path. A template sample the
+// path pairs with a run of capture samples takes the middle one, as their
+// mean would blur the template a little more on every update.
+static void adapt() {
+  DataVec ref[MAX_REF_SIZE];
+  int size = store_get(min_ges_i, 0, ref);
+  int j;
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+  static DataVec cap[MAX_BUFF_SIZE];
+  static uint8_t path1[MAX_REF_SIZE+MAX_BUFF_SIZE], path2[MAX_REF_SIZE+MAX_BUFF_SIZE];
+  Span tmpl = { .ring = ref, .cap = size, .start = 0, .size = size };
+  DataVec *v;
+  int len, m, run;
+
+  for (j = 0; j < capture.size; j++) {
+    cap[j] = *span_at(&capture, j);
+  }
+  len = dtw_path(&tmpl, cap, capture.size, path1, path2);
+  for (m = 0; m < len; m += run) {
+    for (run = 1; m+run < len && path1[m+run] == path1[m]; run++) {
+    }
+    j = path1[m];
+    v = &cap[path2[m+run/2]];
+    ref[j].x = blend(ref[j].x, v->x);
+    ref[j].y = blend(ref[j].y, v->y);
+    ref[j].z = blend(ref[j].z, v->z);
+  }
+#else
+  DataVec *v;
+  // capture[j] lines up with ref[j-min_delay]
+  for (j = max(0,min_delay); j < min(capture.size,size+min_delay); j++) {
+    v = span_at(&capture, j);
+    ref[j-min_delay].x = blend(ref[j-min_delay].x, v->x);
+    ref[j-min_delay].y = blend(ref[j-min_delay].y, v->y);
+    ref[j-min_delay].z = blend(ref[j-min_delay].z, v->z);
+  }
+#endif
+  gesture_store(ref, size, min_ges_i);
+  adapted = min_ges_i;
+  APP_LOG(APP_LOG_LEVEL_INFO, "adapted gesture %d", min_ges_i);
+}
+#endif
+
+// copies the capture into the current training repetition
+static void take_ref() {
+  int i;
+  temp_ges_size[temp_count] = min(capture.size, MAX_REF_SIZE);
+  for (i = 0; i < temp_ges_size[temp_count]; i++) {
+    temp_ges[temp_count][i] = *span_at(&capture, i);
+  }
+  last_rep = temp_count;
+}
+
+static GestureEvent process(AccelData *accel) {
+  static int count = 0;
+  static int find_ref = 0;
+  static int second = 0;
+  static int was_listening = 0;
+  DataVec v;
+  bool found;
+
+  adapted = -1;
+  if (accel->did_vibrate) {
+    return GESTURE_NONE;
+  }
+  // Do dsp here
+  PROFILE_START(t);
+  if (history == 0) {
+    filter_reset(accel);
+  }
+  still = filter(accel, &v);
+  PROFILE_END(PROFILE_FILTER, t);
+  ring_push(&v);
+  if (history >= MAX_REF_SIZE && !start_proc) {
+    start_proc = 1;
+    APP_LOG(APP_LOG_LEVEL_INFO, "Starting processing");
+  }
+  if (!start_proc) {
+    return GESTURE_NONE;
+  }
+#if GESTURE_NOISE_TRACK
+  noise_update(find_ref && count == 0);
+#endif
+  if (make_gesture) { // we were told to create a gesture by the app
+    if (was_listening) {
+      find_ref = 0;
+      count = 0;
+      second = 0;
+      was_listening = 0;
+      capture_release();
+    }
+    if (!find_ref) { // wait for stillness
+      if (still < still_thresh) { // it is still
+        count++;
+        if (count >= count_thresh) { // achieved stillness
+          count = 0;
+          if (second) { // second (end) stillness. we found one temporary reference
+            take_ref();
+            capture_release();
+            temp_count++;
+            second = 0;
+            if (temp_count >= GESTURE_REPS) { // finished finding references
+              make_gesture = 0;
+              session = 0;
+              return make_template() ? GESTURE_MADE : GESTURE_NONE;
+            }
+            if (session) { // this stillness is also the start of the next one
+              find_ref = 1;
+            } else {
+              make_gesture = 0;
+            }
+            return GESTURE_REF_DONE;
+          } else { // this is the first stillness. now find reference
+            find_ref = 1;
+            return GESTURE_GO;
+          }
+        }
+      }
+    } else { // finding reference
+      if (still >= still_thresh) { // moving
+        capture_motion(count == 0);
+        count++;
+      } else { // hit stillness
+        if (count >= count_thresh) { // finished finding reference
+          capture_end();
+          APP_LOG(APP_LOG_LEVEL_INFO, "Made a ref of size %d", capture.size);
+          find_ref = 0;
+          second = 1;
+        } // else we hit a false positive. restart counter but keep finding a reference
+        count = 0;
+      }
+    }
+  } else { // listening regularly
+    was_listening = 1;
+    if (!find_ref) {
+      if (still < still_thresh) { // is still
+        count++;
+        if (count >= count_thresh) { // stillness
+          APP_LOG(APP_LOG_LEVEL_INFO, "Still");
+          show_still = 1;
+          count = 0;
+          if (second) {
+            second = 0;
+            found = recognize();
+#if GESTURE_ADAPT
+            if (found && min_ges < sum_thresh/(1 << GESTURE_ADAPT_MARGIN)) {
+              adapt();
+            }
+#endif
+            capture_release();
+            return found ? GESTURE_FOUND : GESTURE_MISSED;
+          } else { // first stillness, find gesture/reference
+            find_ref = 1;
+          }
+        }
+      }
+    } else { // find gesture/reference
+      if (still >= still_thresh) { // moving
+        capture_motion(count == 0);
+        count++;
+      } else { // still
+        if (count >= count_thresh) { // found gesture/reference
+          capture_end();
+          APP_LOG(APP_LOG_LEVEL_INFO, "Hit gesture");
+          show_still = 0;
+          find_ref = 0;
+          second = 1;
+        }
+        count = 0;
+      }
+    }
+  }
+  return GESTURE_NONE;
+}
+
+GestureEvent gesture_process(AccelData *accel) {
+#if GESTURE_PROFILE
+  // segmentation is whatever the sample takes outside the phases timed inside
+  profile_t start = profile_now();
+  uint32_t inner = profile_recorded();
+  GestureEvent event = process(accel);
+  profile_add(PROFILE_SEGMENT, start + (profile_recorded() - inner));
+  return event;
+#else
+  return process(accel);
+#endif
+}
@@ -0,0 +1,215 @@
+/*
+ * gesture.h
+ * Gesture recognition engine: stillness detection, segmentation, alignment
+ * and template matching. Only needs the AccelData type and APP_LOG from
+ * <pebble.h>, so it also builds on a desktop against host/pebble.h.
+ */
+
+#pragma once
+
+#include <pebble.h>
+
+#define MAX_REF_SIZE 30 // this is the max number of samples that can be in a reference
+#define MAX_BUFF_SIZE 50
+
+// Templates are packed into GESTURE_STORE_BYTES of int8 samples, 3 bytes
+// per sample plus as much again for each DTW envelope. MAX_GESTURES only
+// sizes the index, 6 bytes a template, and the shortlist, 24. The default
+// arena is the RAM nine full-length int16 templates took, and holds twice
+// as many at full length.
+#ifndef MAX_GESTURES
+#define MAX_GESTURES 24
+#endif
+#ifndef GESTURE_STORE_BYTES
+#define GESTURE_STORE_BYTES (9*MAX_REF_SIZE*6*GESTURE_STORE_PLANES)
+#endif
+
+// training repetitions averaged into each template
+#ifndef GESTURE_REPS
+#define GESTURE_REPS 3
+#endif
+
+// samples kept in each capture from before the motion starts and after it
+// stops, out of the MAX_BUFF_SIZE ring
+#ifndef GESTURE_PRE_ROLL
+#define GESTURE_PRE_ROLL 3
+#endif
+#ifndef GESTURE_POST_ROLL
+#define GESTURE_POST_ROLL 2
+#endif
+#if GESTURE_PRE_ROLL < 0 || GESTURE_POST_ROLL < 0 || GESTURE_PRE_ROLL + GESTURE_POST_ROLL >= MAX_BUFF_SIZE
+#error "GESTURE_PRE_ROLL and GESTURE_POST_ROLL must leave room for the motion in the ring"
+#endif
+
+// align() only scans lags in [-ALIGN_MAX_LAG, ALIGN_MAX_LAG]. The default
+// covers every lag of a full capture buffer, so the result is the same as
+// an exhaustive scan; lower it to trade accuracy for time.
+#ifndef ALIGN_MAX_LAG
+#define ALIGN_MAX_LAG (MAX_BUFF_SIZE + MAX_BUFF_SIZE)
+#endif
+
+// How a capture is scored against the templates. BATCH runs align_span()
+// on every template once the motion has ended. STREAM keeps a running
+// correlation per template and lag, updated as each capture sample arrives,
+// so only the peak search is left for the end; it costs about
+// GESTURE_STREAMS*(MAX_BUFF_SIZE+MAX_REF_SIZE)*12 bytes of RAM. Both then take
+// the squared error at the best shift. DTW instead scores the cheapest
+// warping path within GESTURE_DTW_BAND of the diagonal, which tolerates
+// gestures made faster or slower than the template.
+#define GESTURE_MATCHER_BATCH 0
+#define GESTURE_MATCHER_STREAM 1
+#define GESTURE_MATCHER_DTW 2
+#ifndef GESTURE_MATCHER
+#define GESTURE_MATCHER GESTURE_MATCHER_STREAM
+#endif
+
+// templates with a running alignment under GESTURE_MATCHER_STREAM; any
+// beyond these are aligned in one go when the motion ends
+#ifndef GESTURE_STREAMS
+#define GESTURE_STREAMS 9
+#endif
+
+// planes stored per template: the samples, and for DTW their envelopes
+#if GESTURE_MATCHER == GESTURE_MATCHER_DTW
+#define GESTURE_STORE_PLANES 3
+#else
+#define GESTURE_STORE_PLANES 1
+#endif
+
+// Matches scoring under sum_thresh >> GESTURE_ADAPT_MARGIN move their
+// template 1/(1 << GESTURE_ADAPT_RATE) of the way to the aligned capture,
+// so templates follow the user's style. Templates are stored in 32 mG
+// steps, so differences under about 16 << GESTURE_ADAPT_RATE mG are lost.
+// Off by default for DTW, whose scores tell close gestures apart too
+// poorly to learn from its own matches.
+#ifndef GESTURE_ADAPT
+#define GESTURE_ADAPT (GESTURE_MATCHER != GESTURE_MATCHER_DTW)
+#endif
+#define GESTURE_ADAPT_MARGIN 2
+#define GESTURE_ADAPT_RATE 3
+
+// Scale the stillness and match thresholds with a running estimate of the
+// residual energy at rest, so segmentation still works where the wrist
+// never gets as quiet as at a desk. 0 keeps the fixed thresholds.
+#ifndef GESTURE_NOISE_TRACK
+#define GESTURE_NOISE_TRACK 1
+#endif
+
+// Each template carries its own rejection limit, GESTURE_LIMIT_K times the
+// worst score of its training repetitions against it, in steps of
+// 1 << GESTURE_LIMIT_SHIFT squared mG. Scores are compared as fractions of
+// their template's limit, so a tight, low-energy gesture no longer takes
+// any motion within the global threshold. A limit of 0 means none is known
+// and the template keeps the global one; GESTURE_TEMPLATE_LIMIT 0 ignores
+// the limits.
+#ifndef GESTURE_TEMPLATE_LIMIT
+#define GESTURE_TEMPLATE_LIMIT 1
+#endif
+#ifndef GESTURE_LIMIT_K
+#define GESTURE_LIMIT_K 3
+#endif
+#define GESTURE_LIMIT_SHIFT 8
+#define GESTURE_LIMIT_MAX 0xffff
+
+// Matching first shortlists the GESTURE_CANDIDATES templates whose
+// features (shortlist.h) are closest to the capture and aligns only those,
+// so the alignments per motion stay the same however many gestures are
+// stored. 0 aligns every template.
+#ifndef GESTURE_CANDIDATES
+#define GESTURE_CANDIDATES 8
+#endif
+
+// With 1, once the phone has pushed classifier weights covering every
+// stored gesture (classify.h), a motion is told by its features and a few
+// hundred integer multiply-adds instead of an alignment against each
+// template. Off by default: on the recorded traces the classifier, trained
+// off the watch by host/train_linear.py, tells fewer motions right than
+// template matching does.
+#ifndef GESTURE_CLASSIFY
+#define GESTURE_CLASSIFY 0
+#endif
+
+// Separate gravity from the motion with a per-axis Kalman filter, in fixed
+// point, and hand segmentation and matching the linear acceleration, so a
+// gesture scores the same whatever angle the wrist is held at. Templates
+// are stored in the same terms, so ones made with the other setting have
+// to be made again. 0 keeps the moving-average residual for stillness and
+// the raw samples for matching.
+#ifndef GESTURE_KALMAN
+#define GESTURE_KALMAN 1
+#endif
+// What template samples are, raw acceleration (1) or linear (2), sent
+// with templates so ones of the other kind are refused rather than stored.
+#define GESTURE_LAYOUT (GESTURE_KALMAN ? 2 : 1)
+#define KALMAN_Q 16 // squared mG a sample the gravity estimate may drift
+#define KALMAN_R 1600 // squared mG of sensor noise at rest
+#define KALMAN_JERK_MAX 100000000 // keeps the noise term in 32 bits
+
+// Run the filter and squared-error scoring in fixed point rather than
+// software-emulated float. Set to 0 for the original float pipeline.
+#ifndef GESTURE_FIXED_POINT
+#define GESTURE_FIXED_POINT 1
+#endif
+
+#if GESTURE_FIXED_POINT
+typedef int32_t energy_t; // squared mG
+typedef int64_t energy_sum_t;
+#else
+typedef float energy_t;
+typedef float energy_sum_t;
+#endif
+
+typedef struct {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+} DataVec;
+
+// what gesture_process() saw in the latest sample
+typedef enum {
+  GESTURE_NONE = 0,
+  GESTURE_GO, // training: stillness reached, the user can move
+  GESTURE_REF_DONE, // training: one repetition recorded, more are needed. in a session the next may start at once
+  GESTURE_MADE, // training: last repetition recorded, template stored
+  GESTURE_FOUND, // listening: a stored gesture was recognized
+  GESTURE_MISSED, // listening: a motion matched no stored gesture
+} GestureEvent;
+
+void gesture_init();
+
+// runs one accelerometer sample through the filter and state machine
+GestureEvent gesture_process(AccelData *accel);
+
+// start recording the next training repetition
+void gesture_make();
+// records all training repetitions in one go: the stillness that ends each
+// one starts the next, with GESTURE_REF_DONE in between and GESTURE_MADE
+// after the last
+void gesture_make_session();
+// copies the repetition recorded last, as captured, into data and returns
+// its size: what a classifier is trained from, see GESTURE_CLASSIFY
+int gesture_last_rep(DataVec *data);
+
+// true once enough samples have arrived to start filtering
+bool gesture_started();
+// residual energy of the last sample and whether the wrist is at rest
+int gesture_stillness();
+bool gesture_is_still();
+// the energy under which the wrist counts as at rest
+int gesture_still_thresh();
+// restarts the noise estimate from the next idle samples
+void gesture_calibrate();
+
+// index of the last recognized gesture
+int gesture_found();
+// index of the template the latest sample's match adapted, or -1
+int gesture_adapted();
+
+int gesture_count();
+// copies gesture i, as stored, into data and returns its size
+int gesture_get(int i, DataVec *data);
+// rejection limit of gesture i, see GESTURE_TEMPLATE_LIMIT
+int gesture_limit(int i);
+// stores a template from the phone or storage; false if size is not 1 to
+// MAX_REF_SIZE or there is no room
+bool gesture_add(DataVec *data, int size, int limit);
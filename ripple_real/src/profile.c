@@ -0,0 +1,109 @@
+/*
+ * profile.c
+ * Phase timing for profile.h.
+ */
+
+#include "profile.h"
+
+#if GESTURE_PROFILE
+
+#ifdef PEBBLE_HOST
+#include <time.h>
+#endif
+
+static const char *names[PROFILE_PHASES] = {
+  "filter", "segment", "align", "score", "ui", "tick",
+};
+
+static ProfileStats stats[PROFILE_PHASES];
+static uint32_t recorded;
+
+profile_t profile_now() {
+#ifdef PEBBLE_HOST
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (profile_t)(ts.tv_sec*1000000 + ts.tv_nsec/1000);
+#else
+  time_t s;
+  uint16_t ms = time_ms(&s, NULL);
+  return (profile_t)s*1000 + ms;
+#endif
+}
+
+void profile_add(ProfilePhase phase, profile_t start) {
+  ProfileStats *st = &stats[phase];
+  uint32_t t = profile_now() - start;
+  int b = 0;
+  while (b < PROFILE_BUCKETS-1 && (t >> b) != 0) {
+    b++;
+  }
+  st->hist[b]++;
+  if (st->count == 0 || t < st->min) {
+    st->min = t;
+  }
+  if (t > st->max) {
+    st->max = t;
+  }
+  st->count++;
+  st->total += t;
+  recorded += t;
+}
+
+uint32_t profile_recorded() {
+  return recorded;
+}
+
+const ProfileStats *profile_stats(ProfilePhase phase) {
+  return &stats[phase];
+}
+
+const char *profile_name(ProfilePhase phase) {
+  return names[phase];
+}
+
+void profile_reset() {
+  memset(stats, 0, sizeof(stats));
+}
+
+void profile_log() {
+  ProfileStats *st;
+  int p, b, last;
+  for (p = 0; p < PROFILE_PHASES; p++) {
+    st = &stats[p];
+    if (st->count == 0) {
+      continue;
+    }
+    APP_LOG(APP_LOG_LEVEL_INFO, "%s: %d runs, total %d min %d max %d " PROFILE_UNIT, names[p],
+            (int)st->count, (int)st->total, (int)st->min, (int)st->max);
+    for (last = PROFILE_BUCKETS-1; last > 0 && st->hist[last] == 0; last--) {
+    }
+    for (b = 0; b <= last; b++) {
+      APP_LOG(APP_LOG_LEVEL_INFO, "  %s <%d " PROFILE_UNIT ": %d", names[p], 1 << b, (int)st->hist[b]);
+    }
+  }
+}
+
+static uint8_t *put_u32(uint8_t *buf, uint32_t v) {
+  buf[0] = v & 0xff;
+  buf[1] = (v >> 8) & 0xff;
+  buf[2] = (v >> 16) & 0xff;
+  buf[3] = v >> 24;
+  return buf+4;
+}
+
+int profile_pack(uint8_t *buf) {
+  uint8_t *p = buf;
+  int i, b;
+  for (i = 0; i < PROFILE_PHASES; i++) {
+    p = put_u32(p, stats[i].count);
+    p = put_u32(p, stats[i].total);
+    p = put_u32(p, stats[i].min);
+    p = put_u32(p, stats[i].max);
+    for (b = 0; b < PROFILE_BUCKETS; b++) {
+      p = put_u32(p, stats[i].hist[b]);
+    }
+  }
+  return p-buf;
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * profile.h
+ * Optional per-phase timing of the recognition loop. Build with
+ * -DGESTURE_PROFILE=1 to keep a count, total, min, max and power of two
+ * histogram of the time each phase takes per sample (per display update
+ * for PROFILE_UI, per batch for PROFILE_TICK). Times are ms from time_ms()
+ * on the watch and us on the host. Without GESTURE_PROFILE the hooks compile away.
+ */
+
+#pragma once
+
+#include <pebble.h>
+
+#ifndef GESTURE_PROFILE
+#define GESTURE_PROFILE 0
+#endif
+
+typedef enum {
+  PROFILE_FILTER,  // stillness filter
+  PROFILE_SEGMENT, // ring buffer and capture state, everything not below
+  PROFILE_ALIGN,   // correlation and DTW bounds
+  PROFILE_SCORE,   // error against the aligned templates
+  PROFILE_UI,      // display_update()
+  PROFILE_TICK,    // a whole accelerometer batch
+  PROFILE_PHASES,
+} ProfilePhase;
+
+// bucket b holds times under 1 << b, the last one everything longer
+#define PROFILE_BUCKETS 12
+
+typedef struct {
+  uint32_t count;
+  uint32_t total;
+  uint32_t min;
+  uint32_t max;
+  uint32_t hist[PROFILE_BUCKETS];
+} ProfileStats;
+
+#ifdef PEBBLE_HOST
+#define PROFILE_UNIT "us"
+#else
+#define PROFILE_UNIT "ms"
+#endif
+
+// bytes profile_pack() writes: the stats of every phase as little-endian
+// uint32 in ProfileStats order
+#define PROFILE_PACKED_SIZE (PROFILE_PHASES*(4+PROFILE_BUCKETS)*4)
+
+#if GESTURE_PROFILE
+
+typedef uint32_t profile_t;
+
+profile_t profile_now();
+// records the time since start against phase
+void profile_add(ProfilePhase phase, profile_t start);
+// all time recorded so far, to take nested phases out of an outer one
+uint32_t profile_recorded();
+const ProfileStats *profile_stats(ProfilePhase phase);
+const char *profile_name(ProfilePhase phase);
+void profile_reset();
+void profile_log();
+int profile_pack(uint8_t *buf);
+
+#define PROFILE_START(t) profile_t t = profile_now()
+#define PROFILE_END(phase, t) profile_add(phase, t)
+
+#else
+
+#define PROFILE_START(t)
+#define PROFILE_END(phase, t)
+
+#endif
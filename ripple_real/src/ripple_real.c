@@ -5,10 +5,28 @@
  */
 
 #include <pebble.h>
+#include "gesture.h"
+#include "storage.h"
+#include "sync_msg.h"
+#include "profile.h"
+#include "classify.h"
 
 // 25 samples per second
 //#define NUM_SAMPLES 25
 #define ACCEL_STEP_MS 40
+// samples per accelerometer callback, the watch wakes 2.5 times a second
+#define ACCEL_BATCH_SIZE 10
+// diagnostics are redrawn at most this often, and at once when the
+// stillness state flips
+#ifndef DISPLAY_MS
+#define DISPLAY_MS 1000
+#endif
+
+// train all three repetitions in one recording after a single countdown,
+// 0 for a countdown before each
+#ifndef TRAIN_SESSION
+#define TRAIN_SESSION 1
+#endif
 
 #define KEY_MAKE_NEW_GESTURE 0
 #define KEY_NEW_GESTURE_ID 1
@@ -19,20 +37,21 @@
 #define KEY_OLD_GESTURE_DATA 6
 #define KEY_OLD_GESTURE_DATA_SIZE 7
 #define KEY_ON_START 8
-
-#define MAX_REF_SIZE 30 // this is the max number of samples that can be in a reference
-#define MAX_GESTURES 9 // 4 default
-#define MAX_BUFF_SIZE 50
-
-#define max(a,b) (((a)>(b))?(a):(b))
-#define min(a,b) ((a>b)?(b):(a))
-#define abs(a) (((a)>0)?(a):(-(a)))
-
-typedef struct {
-  int16_t x;
-  int16_t y;
-  int16_t z;
-} DataVec;
+#define KEY_HAVE_GESTURES 9 // sent with KEY_ON_START: ids below this are stored already
+#define KEY_OLD_GESTURES 10 // many templates at once, see sync_msg.h
+#define KEY_NEW_GESTURES 11
+#define KEY_SEND_GESTURES 12 // the phone wants every template from this id on
+#define KEY_PROFILE 13 // phone: 1 dumps the phase timings, 2 also resets them. watch: profile_pack()
+#define KEY_UPDATED_GESTURES 14 // templates changed by adaptation, see sync_msg.h
+#define KEY_CALIBRATE 15 // phone: relearn the noise at rest from the next idle samples
+#define KEY_OLD_GESTURE_LIMIT 16 // optional, with KEY_OLD_GESTURE_DATA: the template's gesture_limit()
+#define KEY_CLASSIFIER 17 // phone: weights for classify.h, trained from the KEY_REPETITION data
+#define KEY_REPETITION 18 // each training repetition as captured, DataVec samples
+#define KEY_LAYOUT 19 // GESTURE_LAYOUT, sent with KEY_ON_START; phone: with KEY_OLD_GESTURE_DATA, 1 if absent
+
+// adapted templates are saved and sent this long after the first change,
+// so a run of matches costs one write and one message per template
+#define ADAPT_SYNC_MS (5*60*1000)
 
 // window and layers
 static Window *s_main_window;
@@ -47,91 +66,13 @@ static GFont s_time_font;
 static BitmapLayer *s_background_layer;
 static GBitmap *s_background_bitmap;
 
-// buffer for accel data
-static DataVec accel_buff[MAX_BUFF_SIZE];
-static int accel_size;
-static int head; // head of buffer
-static int start_proc; // begin processing
-static int make_gesture;
-static int min_ges_i;
-static const float alpha = 0.1;
-static const float still_thresh = 1e5;
-static const float sum_thresh = 1e6;
-static const int count_thresh = 4;
-
-// array of recorded gestures
-static DataVec temp_ges[3][MAX_REF_SIZE];
-static int temp_ges_size[3];
-static int temp_count;
-static DataVec gestures[MAX_GESTURES][MAX_REF_SIZE];
-static int gesture_sizes[MAX_GESTURES];
-static int gesture_count;
-//static int gesture_ids[MAX_GESTURES];
-
 static void make_a_gesture();
 
-static int align(DataVec *ges1, int size1, DataVec *ges2, int size2) { // returns delay for the correlation with the greatest ratio between min/max
-  // do x
-  int i, j;
-  int sumx = 0, sumy = 0, sumz = 0;
-  int maxx = 0, maxy = 0, maxz = 0, minx = 0, miny = 0, minz = 0, delx = 0, dely = 0, delz = 0, del = 0, maxd, dy, dz;
-  for (i = -size2+1; i < size1+size2; i++) {
-    sumx = 0;
-    sumy = 0;
-    sumz = 0;
-    for (j = max(0,i); j < min(size1,i+size2); j++) {
-      sumx += ges1[j].x*ges2[j-i].x;
-      sumy += ges1[j].y*ges2[j-i].y;
-      sumz += ges1[j].z*ges2[j-i].z;
-    }
-    if (i == -size2+1) {
-      maxx = sumx;
-      maxy = sumy;
-      maxz = sumz;
-      minx = sumx;
-      miny = sumy;
-      minz = sumz;
-      delx = i;
-      dely = i;
-      delz = i;
-    } else {
-      if (sumx > maxx) {
-	maxx = sumx;
-	delx = i;
-      }
-      if (sumx < minx) {
-	minx = sumx;
-      }
-      if (sumy > maxy) {
-	maxy = sumy;
-	dely = i;
-      }
-      if (sumy < miny) {
-	miny = sumy;
-      }
-      if (sumz > maxz) {
-	maxz = sumz;
-	delz = i;
-      }
-      if (sumz < minz) {
-	minz = sumz;
-      }
-    }
-  }
-  del = delx;
-  maxd = abs(maxx-minx);
-  dy = abs(maxy-miny);
-  dz = abs(maxz-minz);
-  if (dy > maxd) {
-    del = dely;
-    maxd = dy;
-  }
-  if (dz > maxd) {
-    del = delz;
-    // maxr = rz; // unneeded
-  }
-  return del;
-}
+// display scheduler state
+static AccelData s_last_sample;
+static bool s_have_sample;
+static bool s_shown_still;
+static AppTimer *s_display_timer;
 
 static void update_time() {
   // Get a tm structure
@@ -179,280 +120,366 @@ static void update_time() {
   }
 */
 
-static void send_phone_message() { // (int id, DataVec *data, int size) {
-  int id = gesture_count;
-  DataVec *data = gestures[gesture_count];
-  int size = gesture_sizes[gesture_count];
-  const uint8_t key_count = 3;
-  const uint32_t buffer_size = dict_calc_buffer_size(key_count, 4, sizeof(DataVec) * size, 4);
-  uint8_t buffer[buffer_size];
-  DictionaryIterator iter;
-  DictionaryIterator *iter_p = &iter;
-  dict_write_begin(iter_p, buffer, sizeof(buffer));
-  app_message_outbox_begin(&iter_p);
-  dict_write_int32(iter_p, (uint32_t)KEY_NEW_GESTURE_ID, (uint32_t)id);
-  dict_write_int32(iter_p, (uint32_t)KEY_NEW_GESTURE_DATA_SIZE, (uint32_t)size);
-  dict_write_data(iter_p, (uint32_t)KEY_NEW_GESTURE_DATA, (uint8_t *)data, (uint16_t)(sizeof(DataVec) * size));
+// Messages to the phone other than replies go through one queue, sent a
+// message at a time: the start-up message, recognized gestures, training
+// repetitions, then templates from s_sync_next on, then adapted templates.
+// send_next() sends whichever is first; outbox_sent_callback() moves on to
+// the next, and a busy or failed outbox is tried again a second later.
+
+// the start-up message is still to go
+static bool s_ready_pending;
+
+// recognized gestures still to go, oldest first, and whether the oldest is
+// in the outbox
+#define FOUND_QUEUE 4
+static int s_found[FOUND_QUEUE];
+static int s_found_first;
+static int s_found_count;
+static bool s_found_in_flight;
+
+// repetitions still to go to the phone, oldest first, and whether the
+// oldest is in the outbox
+#define REP_QUEUE (GESTURE_REPS+1)
+static DataVec s_reps[REP_QUEUE][MAX_REF_SIZE];
+static int s_rep_size[REP_QUEUE];
+static int s_rep_first;
+static int s_rep_count;
+static bool s_rep_in_flight;
+
+// next template to go to the phone, or -1
+static int s_sync_next = -1;
+static int s_sync_sending; // first template of the message in flight
+
+// templates adapted since they were last saved, those still to go to the
+// phone and those in the message in flight
+static uint32_t s_adapted;
+static uint32_t s_update_ids;
+static uint32_t s_update_sending;
+static AppTimer *s_adapt_timer;
+
+static AppTimer *s_send_timer;
+
+static void send_next();
+
+static void send_retry() {
+  s_send_timer = NULL;
+  send_next();
+}
+
+static void send_later() {
+  if (!s_send_timer) {
+    s_send_timer = app_timer_register(1000, send_retry, NULL);
+  }
+}
+
+// each of these sends one message and returns false if the outbox is busy
+
+static bool ready_send() {
+  int temp = 1;
+  int have = gesture_count();
+  int layout = GESTURE_LAYOUT;
+  DictionaryIterator *iter;
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    return false;
+  }
+  dict_write_int(iter, KEY_ON_START, &temp, sizeof(int), true);
+  dict_write_int(iter, KEY_HAVE_GESTURES, &have, sizeof(int), true);
+  dict_write_int(iter, KEY_LAYOUT, &layout, sizeof(int), true);
   app_message_outbox_send();
-  dict_write_end(iter_p);
+  return true;
 }
 
-static void send_gesture() {
+static bool found_send() {
   DictionaryIterator *iter;
-  app_message_outbox_begin(&iter);
-  dict_write_int(iter, KEY_GESTURE, &min_ges_i, sizeof(int), true);
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    return false;
+  }
+  dict_write_int(iter, KEY_GESTURE, &s_found[s_found_first], sizeof(int), true);
   app_message_outbox_send();
+  s_found_in_flight = true;
+  return true;
 }
 
-static void timer_callback(void *data) {
-  // Long lived buffer
-  static char s_buffer[128];
-  static char s_buffer2[128];
-    
-  static float x_mavg;
-  static float y_mavg;
-  static float z_mavg;
-  static float x_diff;
-  static float y_diff;
-  static float z_diff;
-  static float still;
-  static int count = 0;
-  static int find_ref = 0;
-  static int second = 0;
-  static int was_listening = 0;
-  static int show_still = 0;
-  
-  int delay1; // used for correlation
-  int delay2;
-  int delay; // correlation during regular listening
-  int start, end, num, size;
-  float sum, avg, min_ges;
-  int i, j;
-  AccelData accel = (AccelData) { .x = 0, .y = 0, .z = 0 };
-  accel_service_peek(&accel);
+static bool rep_send() {
+  DictionaryIterator *iter;
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    return false;
+  }
+  dict_write_data(iter, KEY_REPETITION, (uint8_t *)s_reps[s_rep_first], s_rep_size[s_rep_first]*sizeof(DataVec));
+  app_message_outbox_send();
+  s_rep_in_flight = true;
+  return true;
+}
 
-  // Compose string of all data
-  snprintf(s_buffer, sizeof(s_buffer), 
-	   "X: %d Y: %d Z: %d",
-	   accel.x, accel.y, accel.z);
-  
-  //Show the data
-  text_layer_set_text(s_output_layer, s_buffer);
+// the templates from s_sync_next on, as many as fit in one message
+static bool sync_send() {
+  DictionaryIterator *iter;
+  uint8_t *buf;
+  int max, len, next;
+
+  max = app_message_outbox_size_maximum() - dict_calc_buffer_size(1, 0);
+  buf = malloc(max);
+  if (!buf) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "No memory to send templates");
+    return false;
+  }
+  len = sync_pack(buf, max, s_sync_next, &next);
+  if (len == 0) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Template %d does not fit a message", s_sync_next);
+    free(buf);
+    s_sync_next = -1;
+    send_later(); // for whatever is queued after them
+    return true;
+  }
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    free(buf);
+    return false;
+  }
+  dict_write_data(iter, KEY_NEW_GESTURES, buf, len);
+  app_message_outbox_send();
+  free(buf);
+  s_sync_sending = s_sync_next;
+  s_sync_next = next < gesture_count() ? next : -1;
+  return true;
+}
 
-  if (!accel.did_vibrate) {
-    // accel_buff[head].x = accel.x;
-    // accel_buff[head].y = accel.y;
-    // accel_buff[head].z = accel.z;
-    head = (head+1)%(MAX_BUFF_SIZE);
-    if (head >= MAX_REF_SIZE && !start_proc) {
-      start_proc = 1;
-      APP_LOG(APP_LOG_LEVEL_INFO, "Starting processing");
-      x_mavg = accel.x; // accel_buff[head].x;
-      y_mavg = accel.y; // accel_buff[head].y;
-      z_mavg = accel.z; // accel_buff[head].z;
-      x_diff = 0;
-      y_diff = 0;
-      z_diff = 0;
+// as many of s_update_ids as fit in one message
+static bool update_send() {
+  DictionaryIterator *iter;
+  uint8_t *buf;
+  uint32_t left = s_update_ids;
+  int max, len;
+
+  max = app_message_outbox_size_maximum() - dict_calc_buffer_size(1, 0);
+  buf = malloc(max);
+  if (!buf) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "No memory to send templates");
+    return false;
+  }
+  len = sync_pack_ids(buf, max, &left);
+  if (len == 0) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Adapted templates do not fit a message");
+    free(buf);
+    s_update_ids = 0;
+    return true;
+  }
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+    free(buf);
+    return false;
+  }
+  dict_write_data(iter, KEY_UPDATED_GESTURES, buf, len);
+  app_message_outbox_send();
+  free(buf);
+  s_update_sending = s_update_ids & ~left;
+  s_update_ids = left;
+  return true;
+}
+
+static void send_next() {
+  bool sent;
+  if (s_sync_next >= gesture_count()) {
+    s_sync_next = -1;
+  }
+  if (s_ready_pending) {
+    sent = ready_send();
+  } else if (s_found_count > 0) {
+    sent = found_send();
+  } else if (s_rep_count > 0) {
+    sent = rep_send();
+  } else if (s_sync_next >= 0) {
+    sent = sync_send();
+  } else if (s_update_ids != 0) {
+    sent = update_send();
+  } else {
+    return;
+  }
+  if (!sent) {
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Outbox busy, sending later");
+    send_later();
+  }
+}
+
+static void save_adapted() {
+  int i;
+  for (i = 0; i < gesture_count(); i++) {
+    if (s_adapted & (1u << i)) {
+      storage_save(i);
     }
-    if (start_proc) {
-      // Do dsp here
-      x_mavg = x_mavg + alpha*((float)accel.x - x_mavg);
-      y_mavg = y_mavg + alpha*((float)accel.y - y_mavg);
-      z_mavg = z_mavg + alpha*((float)accel.z - z_mavg);
-      x_diff = (float)accel.x - x_mavg;
-      y_diff = (float)accel.y - y_mavg;
-      z_diff = (float)accel.z - z_mavg;
-      still = x_diff*x_diff + y_diff*y_diff + z_diff*z_diff;
-      if (show_still) {
-	snprintf(s_buffer2, sizeof(s_buffer2), "STILL S: %d", (int)still);
-      } else {
-	snprintf(s_buffer2, sizeof(s_buffer2), "S: %d", (int)still);
-      }
-      text_layer_set_text(s_output_layer2, s_buffer2);
-      if (make_gesture) { // we were told to create a gesture by the app
-	if (was_listening) {
-	  find_ref = 0;
-	  count = 0;
-	  second = 0;
-	  was_listening = 0;
-	}
-	if (!find_ref) { // wait for stillness
-	  if (still < still_thresh) { // it is still
-	    count++;
-	    if (count >= count_thresh) { // achieved stillness
-	      text_layer_set_text(s_stay_still, "Go!");
-	      count = 0;
-	      if (second) { // second (end) stillness. we found one temporary reference
-		// temp_ges[temp_count] now holds our reference
-		temp_count++;
-		second = 0;
-		make_gesture = 0;
-		text_layer_destroy(s_stay_still);
-		make_a_gesture();
-		if (temp_count >= 3) { // finished finding references
-		  APP_LOG(APP_LOG_LEVEL_INFO, "Aligning and Averaging");
-		  // we now align and average the references
-		  delay1 = align(temp_ges[0],temp_ges_size[0],temp_ges[1],temp_ges_size[1]); // returns delay of second to match first
-		  APP_LOG(APP_LOG_LEVEL_INFO, "delay1: %d", delay1);
-		  delay2 = align(temp_ges[0],temp_ges_size[0],temp_ges[2],temp_ges_size[2]);
-		  APP_LOG(APP_LOG_LEVEL_INFO, "delay2: %d", delay2);
-		  start = min(0,delay1);
-		  start = min(start,delay2);
-		  end = max(temp_ges_size[0], temp_ges_size[1]+delay1);
-		  end = max(end, temp_ges_size[2]+delay2);
-		  num = 0;
-		  size = end-start;
-		  for (i = 0; i < size; i++) {
-		    gestures[gesture_count][i].x = 0;
-		    gestures[gesture_count][i].y = 0;
-		    gestures[gesture_count][i].z = 0;
-		    if (i+start >= 0 && i+start < temp_ges_size[0]) {
-		      num++;
-		      gestures[gesture_count][i].x += temp_ges[0][i+start].x;
-		      gestures[gesture_count][i].y += temp_ges[0][i+start].y;
-		      gestures[gesture_count][i].z += temp_ges[0][i+start].z;
-		    }
-		    if (i+start >= delay1 && i+start < temp_ges_size[1] + delay1) {
-		      num++;
-		      gestures[gesture_count][i].x += temp_ges[1][i+start-delay1].x;
-		      gestures[gesture_count][i].y += temp_ges[1][i+start-delay1].y;
-		      gestures[gesture_count][i].z += temp_ges[1][i+start-delay1].z;
-		    }
-		    if (i+start >= delay2 && i+start < temp_ges_size[2] + delay2) {
-		      num++;
-		      gestures[gesture_count][i].x += temp_ges[2][i+start-delay2].x;
-		      gestures[gesture_count][i].y += temp_ges[2][i+start-delay2].y;
-		      gestures[gesture_count][i].z += temp_ges[2][i+start-delay2].z;
-		    }
-		    gestures[gesture_count][i].x /= num;
-		    gestures[gesture_count][i].y /= num;
-		    gestures[gesture_count][i].z /= num;
-		    //APP_LOG(APP_LOG_LEVEL_INFO, "num:%d", num);
-		    num = 0;
-		  }
-		  gesture_sizes[gesture_count] = size;
-		  APP_LOG(APP_LOG_LEVEL_INFO, "Made gesture of size %d for id %d ", size, gesture_count);
-		  /*for (i = 0; i < size; i++) {
-		    APP_LOG(APP_LOG_LEVEL_INFO, "%d", gestures[gesture_count][i].z);
-		    }*/
-		  light_enable(false); // success only
-		  app_timer_register(750, send_phone_message, NULL);
-		  gesture_count++;
-		  temp_count = 0;
-		}
-	      } else { // this is the first stillness. now find reference
-		find_ref = 1;
-	      }
-	    }
-	  }
-	} else { // finding reference
-	  if (still >= still_thresh) { // moving
-	    if (count < MAX_REF_SIZE) {
-	      temp_ges[temp_count][count].x = accel.x;
-	      temp_ges[temp_count][count].y = accel.y;
-	      temp_ges[temp_count][count].z = accel.z;
-	      count++;
-	    } else { // hit max reference size. finished finding reference
-	      APP_LOG(APP_LOG_LEVEL_INFO, "Hit max ref");
-	      temp_ges_size[temp_count] = MAX_REF_SIZE;
-	      find_ref = 0;
-	      count = 0;
-	      second = 1; // find second stillness
-	    }
-	  } else { // hit stillness
-	    if (count >= count_thresh) { // finished finding reference
-	      APP_LOG(APP_LOG_LEVEL_INFO, "Made a ref of size %d", count);
-	      /*for (i = 0; i < count; i++) {
-		APP_LOG(APP_LOG_LEVEL_INFO, "%d", temp_ges[temp_count][i].z);
-		}*/
-	      temp_ges_size[temp_count] = count;
-	      find_ref = 0;
-	      second = 1;
-	    } // else we hit a false positive. restart counter but keep finding a reference
-	    count = 0;
-	  }
-	}
-      } else { // listening regularly
-	was_listening = 1;
-	if (!find_ref) {
-	  if (still < still_thresh) { // is still
-	    count++;
-	    if (count >= count_thresh) { // stillness
-	      APP_LOG(APP_LOG_LEVEL_INFO, "Still");
-	      show_still = 1;
-	      count = 0;
-	      if (second) {
-		second = 0;
-		min_ges_i = 0;
-		min_ges = 0;
-		for (i = 0; i < gesture_count; i++) { // evaluate similarity of each gesture
-		  APP_LOG(APP_LOG_LEVEL_INFO, "evaluating gesture num: %d", i);
-		  delay = align(accel_buff, MAX_BUFF_SIZE, gestures[i], gesture_sizes[i]);
-		  APP_LOG(APP_LOG_LEVEL_INFO, "delay is: %d", delay);
-		  sum = 0;
-		  for (j = max(0,delay); j < min(MAX_BUFF_SIZE,gesture_sizes[i]+delay); j++) {
-		    sum += (((float)(gestures[i][j].x - accel_buff[j-delay].x))*((float)(gestures[i][j].x - accel_buff[j-delay].x))) + (((float)(gestures[i][j].y - accel_buff[j-delay].y))*((float)(gestures[i][j].y - accel_buff[j-delay].y))) + (((float)(gestures[i][j].z - accel_buff[j-delay].z))*((float)(gestures[i][j].z - accel_buff[j-delay].z)));
-		  }
-		  avg = sum/(min(MAX_BUFF_SIZE,gesture_sizes[i]+delay) - max(0,delay));
-		  if (i == 0) {
-		    min_ges = avg;
-		  }
-		  if (avg < min_ges) {
-		    min_ges = avg;
-		    min_ges_i = i;
-		  }
-		}
-		APP_LOG(APP_LOG_LEVEL_INFO, "minimum square error: %de3", (int)(min_ges/1000));
-		if (min_ges < sum_thresh && gesture_count) {
-		  // found gesture!
-		  // send gesture for min_ges_i
-		  APP_LOG(APP_LOG_LEVEL_INFO, "found gesture %d", min_ges_i);
-		  /*const uint32_t buffer_size = dict_calc_buffer_size(1, 4);
-		  uint8_t buffer[buffer_size];
-		  DictionaryIterator iter;
-		  DictionaryIterator *iter_p = &iter;
-		  dict_write_begin(iter_p, buffer, sizeof(buffer));
-		  app_message_outbox_begin(&iter_p);
-		  dict_write_int32(iter_p, (uint32_t)KEY_GESTURE, (uint32_t)(min_ges_i+1));
-		  app_message_outbox_send();
-		  dict_write_end(iter_p);*/
-		  app_timer_register(750, send_gesture, NULL);
-		}
-	      } else { // first stillness, find gesture/reference
-		find_ref = 1;
-	      }
-	    }
-	  }
-	} else { // find gesture/reference
-	  if (still >= still_thresh) { // moving
-	    if (count < MAX_BUFF_SIZE) {
-	      accel_buff[count].x = accel.x;
-	      accel_buff[count].y = accel.y;
-	      accel_buff[count].z = accel.z;
-	      count++;
-	    } else { //hit max buffer size
-	      APP_LOG(APP_LOG_LEVEL_INFO, "Hit max gesture buffer");
-	      accel_size = MAX_BUFF_SIZE;
-	      show_still = 0;
-	      find_ref = 0;
-	      count = 0;
-	      second = 1;
-	    }
-	  } else { // still
-	    if (count >= count_thresh) { // found gesture/reference
-	      APP_LOG(APP_LOG_LEVEL_INFO, "Hit gesture");
-	      accel_size = count;
-	      show_still = 0;
-	      find_ref = 0;
-	      second = 1;
-	    }
-	    count = 0;	      
-	  }
-	}
-      }
+  }
+}
+
+// saves the adapted templates and queues them for the phone
+static void adapted_flush() {
+  s_adapt_timer = NULL;
+  save_adapted();
+  s_update_ids |= s_adapted;
+  s_adapted = 0;
+  send_next();
+}
+
+static void template_adapted(int i) {
+  s_adapted |= 1u << i;
+  if (!s_adapt_timer) {
+    s_adapt_timer = app_timer_register(ADAPT_SYNC_MS, adapted_flush, NULL);
+  }
+}
+
+static void send_phone_message() {
+  s_sync_next = gesture_count()-1; // the gesture that was just made
+  send_next();
+}
+
+// queues the repetition just recorded, for the phone to train the
+// classifier from
+static void send_repetition() {
+  int i, next;
+  if (s_rep_count == REP_QUEUE) { // the phone is not taking them
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Dropping an unsent repetition");
+    // the oldest not in the outbox goes, and the one in it takes its slot
+    next = (s_rep_first+1)%REP_QUEUE;
+    if (s_rep_in_flight) {
+      memcpy(s_reps[next], s_reps[s_rep_first], sizeof(s_reps[0]));
+      s_rep_size[next] = s_rep_size[s_rep_first];
+    }
+    s_rep_first = next;
+    s_rep_count--;
+  }
+  i = (s_rep_first+s_rep_count)%REP_QUEUE;
+  s_rep_size[i] = gesture_last_rep(s_reps[i]);
+  s_rep_count++;
+  send_next();
+}
+
+// queues gesture_found() for the phone
+static void send_gesture() {
+  int next;
+  if (s_found_count == FOUND_QUEUE) {
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Dropping an unsent gesture");
+    // as for repetitions, the oldest not in the outbox goes
+    next = (s_found_first+1)%FOUND_QUEUE;
+    if (s_found_in_flight) {
+      s_found[next] = s_found[s_found_first];
     }
+    s_found_first = next;
+    s_found_count--;
   }
-  app_timer_register(ACCEL_STEP_MS, timer_callback, NULL);
+  s_found[(s_found_first+s_found_count)%FOUND_QUEUE] = gesture_found();
+  s_found_count++;
+  send_next();
+}
+
+// logs the phase timings and sends them to the phone
+static void send_profile(bool reset) {
+#if GESTURE_PROFILE
+  uint8_t buf[PROFILE_PACKED_SIZE];
+  DictionaryIterator *iter;
+  profile_log();
+  if (app_message_outbox_begin(&iter) == APP_MSG_OK) {
+    dict_write_data(iter, KEY_PROFILE, buf, profile_pack(buf));
+    app_message_outbox_send();
+  }
+  if (reset) {
+    profile_reset();
+  }
+#else
+  APP_LOG(APP_LOG_LEVEL_WARNING, "Built without GESTURE_PROFILE");
+#endif
+}
+
+static void handle_event(GestureEvent event) {
+  switch (event) {
+  case GESTURE_GO:
+    text_layer_set_text(s_stay_still, "Go!");
+    break;
+  case GESTURE_REF_DONE:
+    send_repetition();
+#if TRAIN_SESSION
+    text_layer_set_text(s_stay_still, "Again!");
+#else
+    text_layer_destroy(s_stay_still);
+    make_a_gesture();
+#endif
+    break;
+  case GESTURE_MADE:
+    text_layer_destroy(s_stay_still);
+    light_enable(false); // success only
+    storage_save(gesture_count()-1);
+    send_repetition();
+    app_timer_register(750, send_phone_message, NULL);
+    break;
+  case GESTURE_FOUND:
+    if (gesture_adapted() >= 0) {
+      template_adapted(gesture_adapted());
+    }
+    send_gesture();
+    break;
+  case GESTURE_MISSED:
+  case GESTURE_NONE:
+    break;
+  }
+}
+
+// sets the text of a layer, unless it already shows it, so unchanged
+// values do not mark the window dirty
+static void show_text(TextLayer *layer, char *shown, size_t size, const char *text) {
+  if (strcmp(shown, text) == 0) {
+    return;
+  }
+  strncpy(shown, text, size-1);
+  shown[size-1] = '\0';
+  text_layer_set_text(layer, shown);
+}
+
+static void display_update(void *data) {
+  // Long lived buffers
+  static char s_buffer[32];
+  static char s_buffer2[32];
+  char text[32];
+  PROFILE_START(ui);
+
+  s_display_timer = NULL;
+  if (s_have_sample) {
+    snprintf(text, sizeof(text), "X: %d Y: %d Z: %d", s_last_sample.x, s_last_sample.y, s_last_sample.z);
+    show_text(s_output_layer, s_buffer, sizeof(s_buffer), text);
+  }
+  if (gesture_started()) {
+    s_shown_still = gesture_is_still();
+    if (s_shown_still) {
+      snprintf(text, sizeof(text), "STILL S: %d", gesture_stillness());
+    } else {
+      snprintf(text, sizeof(text), "S: %d T: %d", gesture_stillness(), gesture_still_thresh());
+    }
+    show_text(s_output_layer2, s_buffer2, sizeof(s_buffer2), text);
+  }
+  PROFILE_END(PROFILE_UI, ui);
+}
+
+static void data_handler(AccelData *data, uint32_t num_samples) {
+  static uint64_t last_timestamp;
+  uint32_t i;
+  PROFILE_START(tick);
+
+  // batches arrive back to back, a gap means the service dropped samples
+  if (last_timestamp && data[0].timestamp > last_timestamp + 3*ACCEL_STEP_MS/2) {
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Missed %d ms of samples", (int)(data[0].timestamp - last_timestamp - ACCEL_STEP_MS));
+  }
+  last_timestamp = data[num_samples-1].timestamp;
+
+  for (i = 0; i < num_samples; i++) {
+    handle_event(gesture_process(&data[i]));
+  }
+  s_last_sample = data[num_samples-1];
+  s_have_sample = true;
+
+  if (gesture_started() && gesture_is_still() != s_shown_still) {
+    if (s_display_timer) {
+      app_timer_cancel(s_display_timer);
+    }
+    display_update(NULL);
+  } else if (!s_display_timer) {
+    s_display_timer = app_timer_register(DISPLAY_MS, display_update, NULL);
+  }
+  PROFILE_END(PROFILE_TICK, tick);
 }
 
 static void main_window_load(Window *window) {
@@ -521,7 +548,11 @@ static void gesture_callback3() {
   text_layer_set_overflow_mode(s_stay_still, GTextOverflowModeWordWrap);
   layer_add_child(window_layer, text_layer_get_layer(s_stay_still));
   text_layer_destroy(number);
-  make_gesture = 1;
+#if TRAIN_SESSION
+  gesture_make_session();
+#else
+  gesture_make();
+#endif
 }
 
 static void gesture_callback2() {
@@ -536,7 +567,6 @@ static void gesture_callback1() {
 }
 
 static void make_a_gesture() {
-  if (temp_count >= 3) return;
   APP_LOG(APP_LOG_LEVEL_INFO, "making gesture");  
   Layer *window_layer = window_get_root_layer(s_main_window);
   GRect window_bounds = layer_get_bounds(window_layer);
@@ -556,9 +586,23 @@ static void make_a_gesture() {
 static void inbox_received_callback(DictionaryIterator *iterator, void *context) {
   APP_LOG(APP_LOG_LEVEL_INFO, "Message received!");
 
-  Tuple *t = dict_read_first(iterator);
+  Tuple *t;
   int id = 0;
+  int size = 0;
+  int limit = 0;
+  int layout = 1; // phones that predate KEY_LAYOUT send raw templates
   int valid = 0;
+  bool stored = false;
+
+  // these qualify KEY_OLD_GESTURE_DATA wherever they sit in the message
+  if ((t = dict_find(iterator, KEY_OLD_GESTURE_LIMIT))) {
+    limit = (int)t->value->int32;
+  }
+  if ((t = dict_find(iterator, KEY_LAYOUT))) {
+    layout = (int)t->value->int32;
+  }
+
+  t = dict_read_first(iterator);
   
   // For all items
   while(t != NULL) {
@@ -570,12 +614,13 @@ static void inbox_received_callback(DictionaryIterator *iterator, void *context)
     case KEY_OLD_GESTURE_ID: // ***** ID MUST COME BEFORE SIZE & DATA
       //gesture_ids[gesture_count] = (int)t->value->int32;
       id = (int)t->value->int32;
+      stored = id < gesture_count(); // loaded from storage at launch
       valid++;
       APP_LOG(APP_LOG_LEVEL_INFO, "Received gesture id: %d", id);
       break;
     case KEY_OLD_GESTURE_DATA_SIZE:
       if (valid == 1) {
-	gesture_sizes[id] = (int)t->value->int32;
+	size = (int)t->value->int32;
 	valid++;
       } else {
 	APP_LOG(APP_LOG_LEVEL_ERROR, "Tried to create gesture without ID");
@@ -583,13 +628,51 @@ static void inbox_received_callback(DictionaryIterator *iterator, void *context)
       break;
     case KEY_OLD_GESTURE_DATA:
       if (valid == 2) {
-	memcpy(gestures[gesture_count], (DataVec *)t->value->data, sizeof(DataVec)*gesture_sizes[id]);
+	if (stored) {
+	  APP_LOG(APP_LOG_LEVEL_INFO, "Already have gesture %d", id);
+	} else if (layout != GESTURE_LAYOUT) {
+	  APP_LOG(APP_LOG_LEVEL_ERROR, "Refusing gesture %d in layout %d, not %d", id, layout, GESTURE_LAYOUT);
+	} else if (size <= 0 || size > MAX_REF_SIZE || t->length < size*sizeof(DataVec)) {
+	  APP_LOG(APP_LOG_LEVEL_ERROR, "Bad data for gesture %d of size %d", id, size);
+	} else if (gesture_add((DataVec *)t->value->data, size, limit)) {
+	  storage_save(gesture_count()-1);
+	} else {
+	  APP_LOG(APP_LOG_LEVEL_ERROR, "No room for gesture %d of size %d", id, size);
+	}
       } else {
 	APP_LOG(APP_LOG_LEVEL_ERROR, "Tried to create gesture without size");
       }
-      gesture_count++;
+      break;
+    case KEY_OLD_GESTURE_LIMIT:
+    case KEY_LAYOUT:
+      break; // read above
+    case KEY_OLD_GESTURES:
+      if (!sync_unpack(t->value->data, t->length)) {
+	APP_LOG(APP_LOG_LEVEL_ERROR, "Malformed templates message");
+      }
+      break;
+    case KEY_SEND_GESTURES:
+      s_sync_next = (int)t->value->int32;
+      send_next();
+      break;
+    case KEY_PROFILE:
+      send_profile(t->value->int32 == 2);
+      break;
+    case KEY_CALIBRATE:
+      gesture_calibrate();
+      break;
+    case KEY_CLASSIFIER:
+      if (classify_unpack(t->value->data, t->length)) {
+	storage_save_classifier();
+      } else {
+	APP_LOG(APP_LOG_LEVEL_ERROR, "Malformed classifier message");
+      }
       break;
     case KEY_GESTURE:
+    case KEY_HAVE_GESTURES:
+    case KEY_NEW_GESTURES:
+    case KEY_UPDATED_GESTURES:
+    case KEY_REPETITION:
     case KEY_NEW_GESTURE_ID:
     case KEY_NEW_GESTURE_DATA:
     case KEY_NEW_GESTURE_DATA_SIZE:
@@ -611,10 +694,38 @@ static void inbox_dropped_callback(AppMessageResult reason, void *context) {
 
 static void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context) {
   APP_LOG(APP_LOG_LEVEL_ERROR, "Outbox send failed!");
+  // the start-up message, gestures and repetitions stay queued until sent
+  if (dict_find(iterator, KEY_GESTURE)) {
+    s_found_in_flight = false;
+  }
+  if (dict_find(iterator, KEY_REPETITION)) {
+    s_rep_in_flight = false;
+  }
+  if (dict_find(iterator, KEY_NEW_GESTURES)) { // try the same templates again
+    s_sync_next = s_sync_sending;
+  }
+  if (dict_find(iterator, KEY_UPDATED_GESTURES)) {
+    s_update_ids |= s_update_sending;
+  }
+  send_later();
 }
 
 static void outbox_sent_callback(DictionaryIterator *iterator, void *context) {
   APP_LOG(APP_LOG_LEVEL_INFO, "Outbox send success!");
+  if (dict_find(iterator, KEY_ON_START)) {
+    s_ready_pending = false;
+  }
+  if (dict_find(iterator, KEY_GESTURE) && s_found_in_flight) {
+    s_found_in_flight = false;
+    s_found_first = (s_found_first+1)%FOUND_QUEUE;
+    s_found_count--;
+  }
+  if (dict_find(iterator, KEY_REPETITION) && s_rep_in_flight) {
+    s_rep_in_flight = false;
+    s_rep_first = (s_rep_first+1)%REP_QUEUE;
+    s_rep_count--;
+  }
+  send_next();
 }
 
 static void on_ready() {
@@ -627,11 +738,8 @@ static void on_ready() {
   dict_write_int32(iter_p, (uint32_t)KEY_ON_START, (uint32_t)1);
   app_message_outbox_send();
   dict_write_end(iter_p);*/
-  int temp = 1;
-  DictionaryIterator *iter;
-  app_message_outbox_begin(&iter);
-  dict_write_int(iter, KEY_ON_START, &temp, sizeof(int), true);
-  app_message_outbox_send();
+  s_ready_pending = true;
+  send_next();
 }
 
 static void init() {
@@ -647,14 +755,11 @@ static void init() {
   tick_timer_service_subscribe(MINUTE_UNIT, tick_handler);
 
   // Subscribe to the accelerometer data service
-  // accel_data_service_subscribe(NUM_SAMPLES, data_handler); // **** this is batches
-  accel_data_service_subscribe(0,NULL); // **** this is real time
-  app_timer_register(ACCEL_STEP_MS, timer_callback, NULL);
-  head = 0; // begin head at beginning of buffer
-  start_proc = 0;
-  make_gesture = 0;
-  gesture_count = 0;
-  temp_count = 0;
+  gesture_init();
+  storage_load(); // recognition works before the phone answers
+  accel_data_service_subscribe(ACCEL_BATCH_SIZE, data_handler); // **** this is batches
+  // accel_data_service_subscribe(0,NULL); // **** this is real time
+  accel_service_set_sampling_rate(ACCEL_SAMPLING_25HZ); // ACCEL_STEP_MS apart
 
   // Register callbacks
   app_message_register_inbox_received(inbox_received_callback);
@@ -666,19 +771,18 @@ static void init() {
 
   app_timer_register(1000, on_ready, NULL);
   // app_timer_register(3000, make_a_gesture, NULL); // DEBUGGING PURPOSES *******************
-  // Choose update rate
-  // accel_service_set_sampling_rate(ACCEL_SAMPLING_25HZ); // 25Hz is default
 
   // APP_LOG(APP_LOG_LEVEL_INFO, "App opened!");
 }
 
 static void deinit() {
   // APP_LOG(APP_LOG_LEVEL_INFO, "App closed!");
+  save_adapted();
 
   // Destroy main Window
   window_destroy(s_main_window);
 
-  // accel_data_service_unsubscribe();
+  accel_data_service_unsubscribe();
 }
 
 int main(void) {
@@ -0,0 +1,69 @@
+/*
+ * shortlist.c
+ * Nearest templates by L1 distance between their keys.
+ */
+
+#include "shortlist.h"
+
+// how far a step of magnitude and a zero crossing count against a step of
+// mean, which alone would tell apart neither how hard nor how fast
+#define MAGNITUDE_WEIGHT 1
+#define CROSSING_WEIGHT 4
+
+static int16_t keys[MAX_GESTURES][SHORTLIST_DIMS];
+
+// per-axis means over each half of the motion, then the weighted mean
+// magnitudes and zero crossings
+static void make_key(Span *ges, int16_t *key) {
+  int8_t f[FEATURE_COUNT];
+  int a, s, half = FEATURE_SEGMENTS/2;
+  features_extract(ges, f);
+  for (a = 0; a < 3; a++) {
+    key[a] = key[3+a] = 0;
+    for (s = 0; s < FEATURE_SEGMENTS; s++) {
+      key[(s < half ? 0 : 3) + a] += f[FEATURE_SHAPE + 3*s + a];
+    }
+    key[a] /= half;
+    key[3+a] /= FEATURE_SEGMENTS - half;
+    key[6+a] = MAGNITUDE_WEIGHT*f[FEATURE_MAGNITUDE + a];
+    key[9+a] = CROSSING_WEIGHT*f[FEATURE_CROSSINGS + a];
+  }
+}
+
+void shortlist_reset() {
+  memset(keys, 0, sizeof(keys));
+}
+
+void shortlist_set(int i, Span *tmpl) {
+  if (i < 0 || i >= MAX_GESTURES) {
+    return;
+  }
+  make_key(tmpl, keys[i]);
+}
+
+int shortlist_find(Span *ges, int count, int k, int *out) {
+  int16_t key[SHORTLIST_DIMS];
+  int32_t dist[MAX_GESTURES], d;
+  int n = 0, i, j, a;
+
+  make_key(ges, key);
+  count = count < MAX_GESTURES ? count : MAX_GESTURES;
+  for (i = 0; i < count; i++) {
+    d = 0;
+    for (a = 0; a < SHORTLIST_DIMS; a++) {
+      d += abs(keys[i][a] - key[a]);
+    }
+    // insertion into the k best so far, ties to the lower index
+    for (j = n < k ? n++ : k; j > 0 && dist[j-1] > d; j--) {
+      if (j < k) {
+        dist[j] = dist[j-1];
+        out[j] = out[j-1];
+      }
+    }
+    if (j < k) {
+      dist[j] = d;
+      out[j] = i;
+    }
+  }
+  return n;
+}
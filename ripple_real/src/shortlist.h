@@ -0,0 +1,24 @@
+/*
+ * shortlist.h
+ * Index of the stored templates by a key built from their feature.h
+ * features: per-axis means over each half of the motion, mean magnitudes
+ * and zero crossings. A capture is only aligned against the few templates
+ * whose keys are closest to its own rather than every one. The keys take
+ * 24 bytes a template and a lookup one pass over them, which at
+ * MAX_GESTURES costs less than a tree would.
+ */
+
+#pragma once
+
+#include "feature.h"
+
+// two halves, magnitude and crossings, each for x, y, z
+#define SHORTLIST_DIMS 12
+
+void shortlist_reset();
+// summarizes template i, new or changed
+void shortlist_set(int i, Span *tmpl);
+
+// Leaves in out the up to k of templates 0..count-1 closest to ges, nearest
+// first, and returns how many.
+int shortlist_find(Span *ges, int count, int k, int *out);
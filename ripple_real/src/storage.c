@@ -0,0 +1,146 @@
+/*
+ * storage.c
+ * Persistent template storage. Layout, one persist key per template so each
+ * fits in PERSIST_DATA_MAX_LENGTH:
+ *
+ *   PERSIST_KEY_VERSION  int, STORAGE_VERSION
+ *   PERSIST_KEY_LAYOUT   int, the GESTURE_LAYOUT of the samples
+ *   PERSIST_KEY_COUNT    int, templates stored
+ *   PERSIST_KEY_FIRST+i  uint8 size, then size int8 x, y, z samples in
+ *                        steps of 1 << STORE_SHIFT mG, then the uint16
+ *                        limit, little-endian. Records written before
+ *                        limits end at the samples and load with none.
+ *   PERSIST_KEY_CLASSIFIER      int, bytes of classify_pack() stored
+ *   PERSIST_KEY_CLASSIFIER+1+k  the k-th PERSIST_DATA_MAX_LENGTH of them
+ *
+ * Bump STORAGE_VERSION whenever any of this, or STORE_SHIFT, changes.
+ * Templates of linear acceleration (GESTURE_KALMAN) are a layout of their
+ * own, as raw ones would never match; storage in either another version
+ * or another layout is dropped. Versions 1 and 2 had no layout key: they
+ * were the layout, with records as they are now.
+ */
+
+#include "storage.h"
+#include "gesture.h"
+#include "store.h"
+#include "classify.h"
+
+#define min(a,b) ((a>b)?(b):(a))
+
+#define STORAGE_VERSION 3
+#define STORAGE_VERSION_LAYOUT 2 // the last version that was the layout
+
+#define PERSIST_KEY_VERSION 0
+#define PERSIST_KEY_COUNT 1
+#define PERSIST_KEY_FIRST 2
+#define PERSIST_KEY_CLASSIFIER (PERSIST_KEY_FIRST + MAX_GESTURES)
+#define PERSIST_KEY_LAYOUT (PERSIST_KEY_CLASSIFIER + 1 + (CLASSIFY_PACKED_MAX + PERSIST_DATA_MAX_LENGTH-1)/PERSIST_DATA_MAX_LENGTH)
+
+static void write_version() {
+  persist_write_int(PERSIST_KEY_VERSION, STORAGE_VERSION);
+  persist_write_int(PERSIST_KEY_LAYOUT, GESTURE_LAYOUT);
+}
+
+static void load_classifier() {
+  uint8_t buf[CLASSIFY_PACKED_MAX];
+  int len, at, k, chunk;
+
+  if (!persist_exists(PERSIST_KEY_CLASSIFIER)) {
+    return;
+  }
+  len = persist_read_int(PERSIST_KEY_CLASSIFIER);
+  if (len <= 0 || len > (int)sizeof(buf)) {
+    return;
+  }
+  for (at = 0, k = 0; at < len; at += PERSIST_DATA_MAX_LENGTH, k++) {
+    chunk = min(len-at, PERSIST_DATA_MAX_LENGTH);
+    if (persist_read_data(PERSIST_KEY_CLASSIFIER+1+k, &buf[at], chunk) != chunk) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "Stored classifier is unreadable");
+      return;
+    }
+  }
+  if (!classify_unpack(buf, len)) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Stored classifier is for other features");
+  }
+}
+
+void storage_load() {
+  uint8_t buf[1 + MAX_REF_SIZE*sizeof(PackedVec) + 2];
+  DataVec data[MAX_REF_SIZE];
+  int count, i, j, size, len, limit, version, layout;
+  int8_t *p;
+
+  if (!persist_exists(PERSIST_KEY_VERSION)) {
+    return;
+  }
+  version = persist_read_int(PERSIST_KEY_VERSION);
+  layout = persist_exists(PERSIST_KEY_LAYOUT) ? persist_read_int(PERSIST_KEY_LAYOUT) : version;
+  if ((version != STORAGE_VERSION && version > STORAGE_VERSION_LAYOUT) || layout != GESTURE_LAYOUT) {
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Dropping templates stored in version %d, layout %d", version, layout);
+    persist_write_int(PERSIST_KEY_COUNT, 0);
+    persist_write_int(PERSIST_KEY_CLASSIFIER, 0);
+    write_version();
+    return;
+  }
+  count = persist_read_int(PERSIST_KEY_COUNT);
+  for (i = 0; i < count; i++) {
+    len = persist_read_data(PERSIST_KEY_FIRST+i, buf, sizeof(buf));
+    if (len < 1 || buf[0] > MAX_REF_SIZE || len < 1 + buf[0]*3) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "Stored template %d is unreadable", i);
+      break;
+    }
+    size = buf[0];
+    if (size == 0) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "Stored template %d is empty", i);
+      break;
+    }
+    p = (int8_t *)&buf[1];
+    for (j = 0; j < size; j++) {
+      data[j].x = *p++ * (1 << STORE_SHIFT);
+      data[j].y = *p++ * (1 << STORE_SHIFT);
+      data[j].z = *p++ * (1 << STORE_SHIFT);
+    }
+    limit = len >= 1 + size*3 + 2 ? buf[1 + size*3] | buf[2 + size*3] << 8 : 0;
+    if (!gesture_add(data, size, limit)) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "No room for stored template %d", i);
+      break;
+    }
+  }
+  APP_LOG(APP_LOG_LEVEL_INFO, "Loaded %d stored templates", gesture_count());
+  load_classifier();
+}
+
+void storage_save(int i) {
+  uint8_t buf[1 + MAX_REF_SIZE*sizeof(PackedVec) + 2];
+  const PackedVec *v = store_packed(i, 0);
+  int size = store_size(i), limit = store_limit(i), j;
+  int8_t *p = (int8_t *)&buf[1];
+
+  buf[0] = size;
+  for (j = 0; j < size; j++) {
+    *p++ = v[j].x;
+    *p++ = v[j].y;
+    *p++ = v[j].z;
+  }
+  buf[1 + size*3] = limit & 0xff;
+  buf[2 + size*3] = limit >> 8;
+  // the record goes first, so a count on disk never runs past the records
+  persist_write_data(PERSIST_KEY_FIRST+i, buf, 1 + size*3 + 2);
+  if (!persist_exists(PERSIST_KEY_COUNT) || persist_read_int(PERSIST_KEY_COUNT) < i+1) {
+    persist_write_int(PERSIST_KEY_COUNT, i+1);
+  }
+  write_version();
+}
+
+void storage_save_classifier() {
+  uint8_t buf[CLASSIFY_PACKED_MAX];
+  int len = classify_pack(buf), at, k;
+
+  // the length goes last, so it never covers chunks not written yet
+  persist_write_int(PERSIST_KEY_CLASSIFIER, 0);
+  for (at = 0, k = 0; at < len; at += PERSIST_DATA_MAX_LENGTH, k++) {
+    persist_write_data(PERSIST_KEY_CLASSIFIER+1+k, &buf[at], min(len-at, PERSIST_DATA_MAX_LENGTH));
+  }
+  persist_write_int(PERSIST_KEY_CLASSIFIER, len);
+  write_version();
+}
@@ -0,0 +1,21 @@
+/*
+ * storage.h
+ * Keeps the gesture templates, and the classifier's weights, in the
+ * watch's persistent storage, so they are back at launch without waiting
+ * for the phone.
+ */
+
+#pragma once
+
+#include <pebble.h>
+
+// adds every stored template to the engine, in id order, and loads the
+// stored weights. Storage written in another layout is dropped.
+void storage_load();
+
+// writes gesture i, either the newest, after the ones before it, or one
+// stored already that has changed
+void storage_save(int i);
+
+// writes the loaded classifier weights
+void storage_save_classifier();
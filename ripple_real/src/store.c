@@ -0,0 +1,91 @@
+/*
+ * store.c
+ * Packed template store.
+ */
+
+#include "store.h"
+
+typedef struct {
+  uint16_t offset; // first sample in the arena
+  uint8_t size; // samples per plane
+  uint16_t limit;
+} StoreEntry;
+
+static PackedVec arena[GESTURE_STORE_BYTES/sizeof(PackedVec)];
+static int arena_used; // samples
+static StoreEntry entries[MAX_GESTURES];
+static int s_count;
+
+static int8_t encode(int16_t v) {
+  int32_t q = ((int32_t)v + (1 << (STORE_SHIFT-1))) >> STORE_SHIFT;
+  return q > INT8_MAX ? INT8_MAX : (q < INT8_MIN ? INT8_MIN : q);
+}
+
+static int16_t decode(int8_t q) {
+  return (int16_t)q*(1 << STORE_SHIFT);
+}
+
+void store_init() {
+  arena_used = 0;
+  s_count = 0;
+}
+
+int store_count() {
+  return s_count;
+}
+
+int store_size(int i) {
+  return entries[i].size;
+}
+
+static void put(PackedVec *p, DataVec **planes, int count, int size) {
+  int k, j;
+  for (k = 0; k < count; k++) {
+    for (j = 0; j < size; j++, p++) {
+      p->x = encode(planes[k][j].x);
+      p->y = encode(planes[k][j].y);
+      p->z = encode(planes[k][j].z);
+    }
+  }
+}
+
+bool store_add(DataVec **planes, int count, int size) {
+  int n = count*size;
+  if (s_count >= MAX_GESTURES || size <= 0 || size > MAX_REF_SIZE || arena_used+n > (int)(sizeof(arena)/sizeof(arena[0]))) {
+    return false;
+  }
+  entries[s_count].offset = arena_used;
+  entries[s_count].size = size;
+  entries[s_count].limit = 0;
+  put(&arena[arena_used], planes, count, size);
+  arena_used += n;
+  s_count++;
+  return true;
+}
+
+void store_set(int i, DataVec **planes, int count) {
+  put(&arena[entries[i].offset], planes, count, entries[i].size);
+}
+
+int store_limit(int i) {
+  return entries[i].limit;
+}
+
+void store_set_limit(int i, int limit) {
+  entries[i].limit = limit;
+}
+
+const PackedVec *store_packed(int i, int plane) {
+  return &arena[entries[i].offset + plane*entries[i].size];
+}
+
+int store_get(int i, int plane, DataVec *out) {
+  const PackedVec *p = store_packed(i, plane);
+  int size = entries[i].size, j;
+  for (j = 0; j < size; j++) {
+    out[j].x = decode(p[j].x);
+    out[j].y = decode(p[j].y);
+    out[j].z = decode(p[j].z);
+  }
+  return size;
+}
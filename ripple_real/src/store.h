@@ -0,0 +1,41 @@
+/*
+ * store.h
+ * Packed template store. Templates of any length up to MAX_REF_SIZE share
+ * one arena of int8 samples, found through an offset/size index, so the
+ * RAM they take follows what is stored rather than MAX_GESTURES slots of
+ * MAX_REF_SIZE samples.
+ */
+
+#pragma once
+
+#include "gesture.h"
+
+// samples are stored as round(mG / 32), which covers +-4000 mG in 8 bits
+#define STORE_SHIFT 5
+
+typedef struct {
+  int8_t x;
+  int8_t y;
+  int8_t z;
+} PackedVec;
+
+void store_init();
+int store_count();
+int store_size(int i);
+
+// Appends a record of size samples in each of planes arrays, e.g. a
+// template and its envelopes. False if size is not 1 to MAX_REF_SIZE or
+// the index or the arena is full.
+bool store_add(DataVec **planes, int count, int size);
+
+// overwrites the planes of record i with as many samples as it has
+void store_set(int i, DataVec **planes, int count);
+
+// the rejection limit kept with record i, 0 until set
+int store_limit(int i);
+void store_set_limit(int i, int limit);
+
+// decodes plane of record i into out and returns its size
+int store_get(int i, int plane, DataVec *out);
+// the same samples as stored, 1 << STORE_SHIFT mG a step
+const PackedVec *store_packed(int i, int plane);
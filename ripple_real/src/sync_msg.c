@@ -0,0 +1,116 @@
+/*
+ * sync_msg.c
+ * Packing and unpacking of multi-template AppMessage values.
+ */
+
+#include "sync_msg.h"
+#include "gesture.h"
+#include "storage.h"
+#include "codec.h"
+
+// ids travel as bits of a uint32_t
+#if MAX_GESTURES > 32
+#error "sync_pack_ids() needs MAX_GESTURES <= 32"
+#endif
+
+// packs the gestures in want, lowest first, and leaves those that fit in
+// packed
+static int pack(uint8_t *buf, int max, uint32_t want, uint32_t *packed) {
+  DataVec data[MAX_REF_SIZE];
+  uint8_t coded[CODEC_MAX_BYTES(MAX_REF_SIZE)];
+  int count = 0, offset, size, limit, i;
+  uint8_t *entry;
+
+  // the table takes room from the payload, so it is sized first
+  *packed = 0;
+  offset = SYNC_HEADER_SIZE;
+  for (i = 0; i < gesture_count(); i++) {
+    if (!(want & (1u << i))) {
+      continue;
+    }
+    size = gesture_get(i, data);
+    size = codec_encode(data, size, coded, sizeof(coded));
+    if (offset + SYNC_ENTRY_SIZE*(count+1) + size > max) {
+      break;
+    }
+    offset += size;
+    count++;
+    *packed |= 1u << i;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  buf[0] = GESTURE_LAYOUT;
+  buf[1] = count;
+  offset = SYNC_HEADER_SIZE + SYNC_ENTRY_SIZE*count;
+  count = 0;
+  for (i = 0; i < gesture_count(); i++) {
+    if (!(*packed & (1u << i))) {
+      continue;
+    }
+    size = gesture_get(i, data);
+    limit = gesture_limit(i);
+    entry = &buf[SYNC_HEADER_SIZE + SYNC_ENTRY_SIZE*count++];
+    entry[0] = i;
+    entry[1] = size;
+    entry[2] = offset & 0xff;
+    entry[3] = offset >> 8;
+    entry[4] = limit & 0xff;
+    entry[5] = limit >> 8;
+    offset += codec_encode(data, size, &buf[offset], max-offset);
+  }
+  return offset;
+}
+
+int sync_pack(uint8_t *buf, int max, int from, int *next) {
+  uint32_t packed;
+  int len = pack(buf, max, ~0u << from, &packed);
+  *next = from;
+  while (packed & (1u << *next)) {
+    (*next)++;
+  }
+  return len;
+}
+
+int sync_pack_ids(uint8_t *buf, int max, uint32_t *ids) {
+  uint32_t packed;
+  int len = pack(buf, max, *ids, &packed);
+  *ids &= ~packed;
+  return len;
+}
+
+bool sync_unpack(const uint8_t *buf, int len) {
+  DataVec data[MAX_REF_SIZE];
+  const uint8_t *entry;
+  int count, id, size, offset, limit, i;
+
+  if (len < SYNC_HEADER_SIZE || len < SYNC_HEADER_SIZE + SYNC_ENTRY_SIZE*buf[1]) {
+    return false;
+  }
+  if (buf[0] != GESTURE_LAYOUT) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Refusing templates in layout %d, not %d", buf[0], GESTURE_LAYOUT);
+    return false;
+  }
+  count = buf[1];
+  for (i = 0; i < count; i++) {
+    entry = &buf[SYNC_HEADER_SIZE + SYNC_ENTRY_SIZE*i];
+    id = entry[0];
+    size = entry[1];
+    offset = entry[2] | entry[3] << 8;
+    limit = entry[4] | entry[5] << 8;
+    if (size <= 0 || size > MAX_REF_SIZE || offset > len || !codec_decode(&buf[offset], len-offset, data, size)) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "Bad entry %d for gesture %d", i, id);
+      return false;
+    }
+    if (id < gesture_count()) {
+      continue; // stored already
+    }
+    if (!gesture_add(data, size, limit)) {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "No room for gesture %d of size %d", id, size);
+      return true;
+    }
+    storage_save(gesture_count()-1);
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+/*
+ * sync_msg.h
+ * Many gesture templates per AppMessage. The value of KEY_OLD_GESTURES
+ * (phone to watch) and KEY_NEW_GESTURES (watch to phone) is
+ *
+ *   uint8 layout, GESTURE_LAYOUT, uint8 count
+ *   count entries of uint8 id, uint8 size, uint16 offset, uint16 limit
+ *   each template's size samples in codec.h coding, starting offset bytes
+ *   into the value
+ *
+ * little-endian, limit as gesture_limit(). Each message stands on its
+ * own, so a library too big for one message is sent as several, and one
+ * whose templates are in another layout is refused whole.
+ * KEY_UPDATED_GESTURES carries templates the phone has already, changed
+ * by adaptation, in the same format.
+ */
+
+#pragma once
+
+#include <pebble.h>
+
+#define SYNC_HEADER_SIZE 2
+#define SYNC_ENTRY_SIZE 6
+
+// Packs gestures from id from onwards into buf until max bytes are used.
+// Returns the bytes written and leaves the first id not packed in next.
+int sync_pack(uint8_t *buf, int max, int from, int *next);
+
+// Packs the gestures whose bits are set in ids, lowest first, until max
+// bytes are used, and clears their bits. Returns the bytes written.
+int sync_pack_ids(uint8_t *buf, int max, uint32_t *ids);
+
+// Adds and stores every template in a packed value that the watch does not
+// have yet. Returns false if the value is malformed or in another layout.
+bool sync_unpack(const uint8_t *buf, int len);